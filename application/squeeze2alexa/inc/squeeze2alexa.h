@@ -34,7 +34,6 @@
 /* typedefs */
 /*----------------------------------------------------------------------------*/
 
-#define MAX_RENDERERS	32
 #define	AV_TRANSPORT 	"urn:schemas-upnp-org:service:AVTransport:1"
 #define	RENDERING_CTRL 	"urn:schemas-upnp-org:service:RenderingControl:1"
 #define	CONNECTION_MGR 	"urn:schemas-upnp-org:service:ConnectionManager:1"
@@ -95,8 +94,9 @@ struct sMR {
 
 extern char 				glUPnPSocket[];
 extern s32_t				glLogLimit;
+extern s32_t				glDecodeWorkers;
 extern tMRConfig			glMRConfig;
 extern sq_dev_param_t		glDeviceParam;
-extern struct sMR			glMRDevices[MAX_RENDERERS];
+extern table_t				glMRDevices;
 
 #endif
@@ -42,8 +42,9 @@
 /* globals 																	  */
 /*----------------------------------------------------------------------------*/
 s32_t		glLogLimit = -1;
+s32_t		glDecodeWorkers = 0;
 char		glUPnPSocket[128] = "?";
-struct sMR	glMRDevices[MAX_RENDERERS];
+table_t		glMRDevices;
 
 log_level	slimproto_loglevel = lINFO;
 log_level	slimmain_loglevel = lWARN;
@@ -98,6 +99,12 @@ sq_dev_param_t glDeviceParam = {
 #endif
 					false, 					// roon_mode
 					"",						// store_prefix
+					false,					// lock_memory
+					600,					// idle_release
+					0,						// stream_cushion
+					256*1024,				// streambuf_min
+					64*1024,				// chunk_size
+					{ 0, 0, 0, 0, 0 },		// profile
 					{ 	true,				// use_cli
 						"" },   			// server
 				} ;
@@ -119,6 +126,7 @@ static struct mDNShandle_s	*glmDNSsearchHandle = NULL;
 static char					*glLogFile;
 static bool					glDiscovery = false;
 static bool					glAutoSaveConfigFile = false;
+static bool					glConfigChanged = false;
 static pthread_mutex_t		glMainMutex;
 static pthread_cond_t		glMainCond;
 static bool					glInteractive = true;
@@ -136,7 +144,7 @@ static char usage[] =
 		   "  -b <address[:port]>]\tNetwork address and port to bind to\n"
 		   "  -x <config file>\tread config from file (default is ./config.xml)\n"
 		   "  -i <config file>\tdiscover players, save <config file> and exit\n"
-		   "  -I \t\t\tauto save config at every network scan\n"
+		   "  -I \t\t\tauto save config when learned renderer profiles change\n"
 		   "  -f <logfile>\t\tWrite debug to logfile\n"
 		   "  -p <pid file>\t\twrite PID in file\n"
 		   "  -d <log>=<level>\tSet logging level, logs: all|slimproto|slimmain|stream|decode|output|main|util|cast, level: error|warn|info|debug|sdebug\n"
@@ -246,7 +254,7 @@ bool sq_callback(sq_dev_handle_t handle, void *caller, sq_action_t action, u8_t
 		}
 	}
 
-	if (!Device->on && action != SQ_SETNAME && action != SQ_SETSERVER) {
+	if (!Device->on && action != SQ_SETNAME && action != SQ_SETSERVER && action != SQ_SETPROFILE) {
 		LOG_DEBUG("[%p]: device off or not controlled by LMS", caller);
 		pthread_mutex_unlock(&Device->Mutex);
 		return false;
@@ -354,6 +362,12 @@ bool sq_callback(sq_dev_handle_t handle, void *caller, sq_action_t action, u8_t
 		case SQ_SETSERVER:
 			strcpy(Device->sq_config.dynamic.server, inet_ntoa(*(struct in_addr*) param));
 			break;
+		case SQ_SETPROFILE:
+			Device->sq_config.profile = *(sq_profile_t*) param;
+			pthread_mutex_lock(&glMainMutex);
+			glConfigChanged = true;
+			pthread_mutex_unlock(&glMainMutex);
+			break;
 		default:
 			break;
 	}
@@ -583,7 +597,7 @@ static void *MRThread(void *args)
 static void LoadAlexa(void)
 {
 	struct sMR *Device;
-	int i, j;
+	int i;
 	IXML_NodeList *list;
 
 	list = ixmlDocument_getElementsByTagName((IXML_Document*) glConfigID, "device");
@@ -604,17 +618,18 @@ static void LoadAlexa(void)
 		node = ixmlNode_getFirstChild(node);
 		Name = (char*) ixmlNode_getNodeValue(node);
 
-		// device creation so search a free spot.
-		for (j = 0; j < MAX_RENDERERS && glMRDevices[j].Running; j++);
-
-		// no more room !
-		if (j == MAX_RENDERERS) {
-			LOG_ERROR("Too many Cast devices", NULL);
-			break;
+		// device creation, only the last one can be unused (disabled)
+		Device = table_get(&glMRDevices, glMRDevices.count - 1);
+		if (!Device || Device->Running) {
+			Device = table_add(&glMRDevices);
+			// no more room !
+			if (!Device) {
+				LOG_ERROR("Too many Cast devices", NULL);
+				break;
+			}
+			pthread_mutex_init(&Device->Mutex, 0);
 		}
 
-		Device = glMRDevices + j;
-
 		if (AddAlexaDevice(Device, Name, UDN) && !glDiscovery) {
 			// create a new slimdevice
 			Device->SqueezeHandle = sq_reserve_device(Device, Device->on, MimeCaps, &sq_callback);
@@ -633,11 +648,20 @@ static void LoadAlexa(void)
 static void *MainThread(void *args)
 {
 	while (glMainRunning) {
+		bool changed;
 
 		pthread_mutex_lock(&glMainMutex);
 		pthread_cond_reltimedwait(&glMainCond, &glMainMutex, 30*1000);
+		changed = glConfigChanged;
+		glConfigChanged = false;
 		pthread_mutex_unlock(&glMainMutex);
 
+		// persist what has been learned about renderers
+		if (glAutoSaveConfigFile && changed) {
+			LOG_DEBUG("Updating configuration %s", glConfigName);
+			SaveConfig(glConfigName, glConfigID, false);
+		}
+
 		if (glLogFile && glLogLimit != - 1) {
 			u32_t size = ftell(stderr);
 
@@ -730,10 +754,8 @@ static bool Start(void)
 	struct in_addr addr;
 	char IPaddr[16] = "";
 	unsigned Port = 0;
-	int i;
 
-	memset(&glMRDevices, 0, sizeof(glMRDevices));
-	for (i = 0; i < MAX_RENDERERS; i++) pthread_mutex_init(&glMRDevices[i].Mutex, 0);
+	table_init(&glMRDevices, sizeof(struct sMR));
 
 	if (!strstr(glUPnPSocket, "?")) sscanf(glUPnPSocket, "%[^:]:%u", IPaddr, &Port);
 
@@ -747,14 +769,13 @@ static bool Start(void)
 	if (!Port) Port = HTTP_DEFAULT_PORT;
 
 	// start squeeze piece
-	sq_init(IPaddr, Port);
+	sq_init(IPaddr, Port, glDecodeWorkers);
 
 	LOG_INFO("Binding to %s:%d", IPaddr, Port);
 
 	// init mutex & cond no matter what
 	pthread_mutex_init(&glMainMutex, 0);
 	pthread_cond_init(&glMainCond, 0);
-	for (i = 0; i < MAX_RENDERERS; i++) pthread_mutex_init(&glMRDevices[i].Mutex, 0);
 
 	InitSSL();
 
@@ -779,9 +800,17 @@ static bool Stop(void)
 	LOG_DEBUG("terminate main thread ...", NULL);
 	pthread_cond_signal(&glMainCond);
 	pthread_join(glMainThread, NULL);
+
+	// last sessions have updated profiles while stopping devices
+	if (glAutoSaveConfigFile && glConfigChanged) SaveConfig(glConfigName, glConfigID, false);
 	pthread_mutex_destroy(&glMainMutex);
+
 	pthread_cond_destroy(&glMainCond);
-	for (i = 0; i < MAX_RENDERERS; i++) pthread_mutex_destroy(&glMRDevices[i].Mutex);
+	for (i = 0; i < glMRDevices.count; i++) {
+		struct sMR *p = table_get(&glMRDevices, i);
+		pthread_mutex_destroy(&p->Mutex);
+	}
+	// renderer threads are not joined, so their memory is left until exit
 
 	EndSSL();
 
@@ -799,8 +828,8 @@ static void sighandler(int signum) {
 	int i;
 
 	if (!glGracefullShutdown) {
-		for (i = 0; i < MAX_RENDERERS; i++) {
-			struct sMR *p = &glMRDevices[i];
+		for (i = 0; i < glMRDevices.count; i++) {
+			struct sMR *p = table_get(&glMRDevices, i);
 //			if (p->Running && p->sqState == SQ_PLAY) CastStop(p->CastCtx);
 		}
 		LOG_INFO("forced exit", NULL);
@@ -1027,8 +1056,8 @@ int main(int argc, char *argv[])
 		if (!strcmp(resp, "dump") || !strcmp(resp, "dumpall"))	{
 			bool all = !strcmp(resp, "dumpall");
 
-			for (i = 0; i < MAX_RENDERERS; i++) {
-				struct sMR *p = &glMRDevices[i];
+			for (i = 0; i < glMRDevices.count; i++) {
+				struct sMR *p = table_get(&glMRDevices, i);
 				bool Locked = pthread_mutex_trylock(&p->Mutex);
 
 				if (!Locked) pthread_mutex_unlock(&p->Mutex);
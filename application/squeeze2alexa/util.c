@@ -471,9 +471,11 @@ void MakeMacUnique(struct sMR *Device)
 {
 	int i;
 
-	for (i = 0; i < MAX_RENDERERS; i++) {
-		if (!glMRDevices[i].Running || Device == &glMRDevices[i]) continue;
-		if (!memcmp(&glMRDevices[i].sq_config.mac, &Device->sq_config.mac, 6)) {
+	for (i = 0; i < glMRDevices.count; i++) {
+		struct sMR *p = table_get(&glMRDevices, i);
+
+		if (!p->Running || Device == p) continue;
+		if (!memcmp(&p->sq_config.mac, &Device->sq_config.mac, 6)) {
 			u32_t hash = hash32(Device->UDN);
 
 			LOG_INFO("[%p]: duplicated mac ... updating", Device);
@@ -528,8 +530,14 @@ void SaveConfig(char *name, void *ref, bool full)
 	XMLUpdateNode(doc, root, false, "main_log",level2debug(main_loglevel));
 	XMLUpdateNode(doc, root, false, "util_log",level2debug(util_loglevel));
 	XMLUpdateNode(doc, root, false, "log_limit", "%d", (s32_t) glLogLimit);
+	XMLUpdateNode(doc, root, false, "decode_workers", "%d", (s32_t) glDecodeWorkers);
 	XMLUpdateNode(doc, common, false, "streambuf_size", "%d", (u32_t) glDeviceParam.streambuf_size);
 	XMLUpdateNode(doc, common, false, "output_size", "%d", (u32_t) glDeviceParam.outputbuf_size);
+	XMLUpdateNode(doc, common, false, "lock_memory", "%d", (int) glDeviceParam.lock_memory);
+	XMLUpdateNode(doc, common, false, "idle_release", "%d", (u32_t) glDeviceParam.idle_release);
+	XMLUpdateNode(doc, common, false, "stream_cushion", "%d", (u32_t) glDeviceParam.stream_cushion);
+	XMLUpdateNode(doc, common, false, "streambuf_min", "%d", (u32_t) glDeviceParam.streambuf_min);
+	XMLUpdateNode(doc, common, false, "chunk_size", "%d", (u32_t) glDeviceParam.chunk_size);
 	XMLUpdateNode(doc, common, false, "stream_length", "%d", (s32_t) glDeviceParam.stream_length);
 	XMLUpdateNode(doc, common, false, "enabled", "%d", (int) glMRConfig.Enabled);
 	XMLUpdateNode(doc, common, false, "stop_receiver", "%d", (int) glMRConfig.StopReceiver);
@@ -547,11 +555,17 @@ void SaveConfig(char *name, void *ref, bool full)
 	XMLUpdateNode(doc, common, false, "auto_play", "%d", (int) glMRConfig.AutoPlay);
 	XMLUpdateNode(doc, common, false, "server", glDeviceParam.server);
 
-	for (i = 0; i < MAX_RENDERERS; i++) {
+	for (i = 0; i < glMRDevices.count; i++) {
 		IXML_Node *dev_node;
+		sq_profile_t profile;
+
+		p = table_get(&glMRDevices, i);
+		if (!p->Running) continue;
 
-		if (!glMRDevices[i].Running) continue;
-		else p = &glMRDevices[i];
+		// learned by the device's own threads
+		pthread_mutex_lock(&p->Mutex);
+		profile = p->sq_config.profile;
+		pthread_mutex_unlock(&p->Mutex);
 
 		// existing device, keep param and update "name" if LMS has requested it
 		if (old_doc && ((dev_node = (IXML_Node*) FindMRConfig(old_doc, p->UDN)) != NULL)) {
@@ -561,6 +575,8 @@ void SaveConfig(char *name, void *ref, bool full)
 			XMLUpdateNode(doc, dev_node, false, "friendly_name", p->FriendlyName);
 			XMLUpdateNode(doc, dev_node, true, "name", p->sq_config.name);
 			if (*p->sq_config.dynamic.server) XMLUpdateNode(doc, dev_node, true, "server", p->sq_config.dynamic.server);
+			if (profile.streams) XMLUpdateNode(doc, dev_node, true, "http_profile", "%u,%u,%u,%u,%u", profile.streams,
+											   profile.reconnects, profile.ranges, profile.pull_rate, profile.lead);
 		}
 		// new device, add nodes
 		else {
@@ -572,6 +588,8 @@ void SaveConfig(char *name, void *ref, bool full)
 			XMLAddNode(doc, dev_node, "mac", "%02x:%02x:%02x:%02x:%02x:%02x", p->sq_config.mac[0],
 						p->sq_config.mac[1], p->sq_config.mac[2], p->sq_config.mac[3], p->sq_config.mac[4], p->sq_config.mac[5]);
 			XMLAddNode(doc, dev_node, "enabled", "%d", (int) p->Config.Enabled);
+			if (profile.streams) XMLAddNode(doc, dev_node, "http_profile", "%u,%u,%u,%u,%u", profile.streams,
+											profile.reconnects, profile.ranges, profile.pull_rate, profile.lead);
 		}
 	}
 
@@ -613,7 +631,15 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 	if (!strcmp(name, "send_icy")) sq_conf->send_icy = atol(val);
 	if (!strcmp(name, "enabled")) Conf->Enabled = atol(val);
 	if (!strcmp(name, "roon_mode")) sq_conf->roon_mode = atol(val);
+	if (!strcmp(name, "lock_memory")) sq_conf->lock_memory = atol(val);
+	if (!strcmp(name, "idle_release")) sq_conf->idle_release = atol(val);
+	if (!strcmp(name, "stream_cushion")) sq_conf->stream_cushion = atol(val);
+	if (!strcmp(name, "streambuf_min")) sq_conf->streambuf_min = atol(val);
+	if (!strcmp(name, "chunk_size")) sq_conf->chunk_size = atol(val);
 	if (!strcmp(name, "store_prefix")) strcpy(sq_conf->store_prefix, val);			//RO
+#ifdef RESAMPLE
+	if (!strcmp(name, "resample_options")) strcpy(sq_conf->resample_options, val);
+#endif
 	if (!strcmp(name, "stop_receiver")) Conf->StopReceiver = atol(val);
 	if (!strcmp(name, "codecs")) strcpy(sq_conf->codecs, val);
 	if (!strcmp(name, "mode")) strcpy(sq_conf->mode, val);
@@ -635,6 +661,11 @@ static void LoadConfigItem(tMRConfig *Conf, sq_dev_param_t *sq_conf, char *name,
 		sscanf(val,"%2x:%2x:%2x:%2x:%2x:%2x", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
 		for (i = 0; i < 6; i++) sq_conf->mac[i] = mac[i];
 	}
+	if (!strcmp(name, "http_profile")) {
+		sq_profile_t *profile = &sq_conf->profile;
+		sscanf(val, "%u,%u,%u,%u,%u", &profile->streams, &profile->reconnects, &profile->ranges,
+			   &profile->pull_rate, &profile->lead);
+	}
 }
 
 /*----------------------------------------------------------------------------*/
@@ -654,6 +685,7 @@ static void LoadGlobalItem(char *name, char *val)
 	if (!strcmp(name, "main_log")) main_loglevel = debug2level(val);
 	if (!strcmp(name, "util_log")) util_loglevel = debug2level(val);
 	if (!strcmp(name, "log_limit")) glLogLimit = atol(val);
+	if (!strcmp(name, "decode_workers")) glDecodeWorkers = atol(val);
  }
 
 
@@ -25,6 +25,13 @@
 
 #include "squeezelite.h"
 
+#if LINUX || FREEBSD || OSX
+#include <sys/mman.h>
+#endif
+
+extern log_level	 slimmain_loglevel;
+static log_level	*loglevel = &slimmain_loglevel;
+
 // _* called with muxtex locked
 
 
@@ -48,6 +55,11 @@ unsigned _buf_cont_write(struct buffer *buf) {
 	return buf->writep >= buf->readp ? buf->wrap - buf->writep : buf->readp - buf->writep;
 }
 
+// bytes that can be read at readp without handling wrap (all of them when mirrored)
+unsigned _buf_contiguous(struct buffer *buf) {
+	return buf->mirror ? _buf_used(buf) : _buf_cont_read(buf);
+}
+
 unsigned _buf_size(struct buffer *buf) {
 	return buf->size;
 }
@@ -61,6 +73,7 @@ void _buf_inc_readp(struct buffer *buf, unsigned by) {
 	if (buf->readp >= buf->wrap) {
 		buf->readp -= buf->size;
 	}
+	cond_signal(buf->space);
 }
 
 void _buf_inc_writep(struct buffer *buf, unsigned by) {
@@ -74,9 +87,15 @@ void buf_flush(struct buffer *buf) {
 	mutex_lock(buf->mutex);
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
+	cond_signal(buf->space);
 	mutex_unlock(buf->mutex);
 }
 
+// wait (up to wait ms) for reader to free some space, false on timeout
+bool _buf_wait_space(struct buffer *buf, u32_t wait) {
+	return cond_timedwait(buf->space, buf->mutex, wait) == 0;
+}
+
 bool _buf_reset(struct buffer *buf) {
 	if (buf->readp != buf->writep) return false;
 	buf->readp  = buf->buf;
@@ -87,6 +106,8 @@ bool _buf_reset(struct buffer *buf) {
 // adjust buffer to multiple of mod bytes so reading in multiple always wraps on frame boundary
 void buf_adjust(struct buffer *buf, size_t mod) {
 	size_t size;
+	// a mirror never splits reads and its size cannot change
+	if (buf->mirror) mod = 1;
 	mutex_lock(buf->mutex);
 	size = ((unsigned)(buf->base_size / mod)) * mod;
 	buf->readp  = buf->buf;
@@ -96,16 +117,213 @@ void buf_adjust(struct buffer *buf, size_t mod) {
 	mutex_unlock(buf->mutex);
 }
 
+// get memory from pool (or plain malloc when no pool), new memory is prefaulted
+static u8_t *pool_alloc(struct buf_pool *pool, size_t size) {
+	u8_t *mem = NULL;
+	int i, slot = -1;
+
+	if (!pool) return malloc(size);
+
+	mutex_lock(pool->mutex);
+
+	for (i = 0; i < BUF_POOL_SIZE; i++) {
+		if (pool->item[i].busy) continue;
+		if (pool->item[i].mem && pool->item[i].size == size) {
+			pool->item[i].busy = true;
+			mutex_unlock(pool->mutex);
+			return pool->item[i].mem;
+		}
+		// prefer an empty slot, otherwise evict an idle one of wrong size
+		if (slot < 0 || !pool->item[i].mem) slot = i;
+	}
+
+	if (slot >= 0 && pool->item[slot].mem) {
+#if LINUX || FREEBSD || OSX
+		if (pool->lock) munlock(pool->item[slot].mem, pool->item[slot].size);
+#endif
+		free(pool->item[slot].mem);
+		pool->item[slot].mem = NULL;
+	}
+
+	mem = malloc(size);
+
+	if (mem) {
+#if LINUX || FREEBSD
+		touch_memory(mem, size);
+#endif
+#if LINUX || FREEBSD || OSX
+		if (pool->lock && slot >= 0 && mlock(mem, size)) {
+			LOG_WARN("unable to lock %zu bytes in memory (%s)", size, strerror(errno));
+		}
+#endif
+		if (slot >= 0) {
+			pool->item[slot].mem = mem;
+			pool->item[slot].size = size;
+			pool->item[slot].busy = true;
+		}
+	}
+
+	mutex_unlock(pool->mutex);
+
+	return mem;
+}
+
+#if MIRROR
+/*---------------------------------------------------------------------------*/
+// mirrored memory is a multiple of pages
+static size_t mirror_size(size_t size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) / page * page;
+}
+
+/*---------------------------------------------------------------------------*/
+// map the same pages twice back-to-back, reading past wrap gives start of buffer
+static u8_t *mirror_alloc(struct buf_pool *pool, size_t size) {
+	u8_t *mem;
+	int fd = memfd_create("buffer", MFD_CLOEXEC);
+
+	if (fd < 0) return NULL;
+
+	if (ftruncate(fd, size) < 0 ||
+		(mem = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	if (mmap(mem, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+		mmap(mem + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(mem, 2 * size);
+		mem = NULL;
+	}
+
+	close(fd);
+
+	if (mem) {
+		touch_memory(mem, size);
+		if (pool && pool->lock && mlock(mem, size)) {
+			LOG_WARN("unable to lock %zu bytes in memory (%s)", size, strerror(errno));
+		}
+	}
+
+	return mem;
+}
+
+/*---------------------------------------------------------------------------*/
+static void mirror_free(u8_t *mem, size_t size) {
+	munmap(mem, 2 * size);
+}
+#endif
+
+// give memory back to pool, free it if it does not belong to it
+static void pool_free(struct buf_pool *pool, u8_t *mem) {
+	int i;
+
+	if (pool) {
+		mutex_lock(pool->mutex);
+		for (i = 0; i < BUF_POOL_SIZE && pool->item[i].mem != mem; i++);
+		if (i < BUF_POOL_SIZE) pool->item[i].busy = false;
+		mutex_unlock(pool->mutex);
+		if (i < BUF_POOL_SIZE) return;
+	}
+
+	free(mem);
+}
+
+void buf_pool_init(struct buf_pool *pool, bool lock) {
+	memset(pool->item, 0, sizeof(pool->item));
+	pool->lock = lock;
+	mutex_create(pool->mutex);
+}
+
+// all buffers using the pool must have been destroyed
+void buf_pool_destroy(struct buf_pool *pool) {
+	int i;
+
+	for (i = 0; i < BUF_POOL_SIZE; i++) {
+		if (!pool->item[i].mem) continue;
+#if LINUX || FREEBSD || OSX
+		if (pool->lock) munlock(pool->item[i].mem, pool->item[i].size);
+#endif
+		free(pool->item[i].mem);
+		pool->item[i].mem = NULL;
+	}
+
+	mutex_destroy(pool->mutex);
+}
+
+// release idle memory kept by the pool
+void buf_pool_trim(struct buf_pool *pool) {
+	int i;
+
+	mutex_lock(pool->mutex);
+
+	for (i = 0; i < BUF_POOL_SIZE; i++) {
+		if (!pool->item[i].mem || pool->item[i].busy) continue;
+#if LINUX || FREEBSD || OSX
+		if (pool->lock) munlock(pool->item[i].mem, pool->item[i].size);
+#endif
+		free(pool->item[i].mem);
+		pool->item[i].mem = NULL;
+	}
+
+	mutex_unlock(pool->mutex);
+}
+
+// called with mutex locked, shrink allocated memory (not only visible size), does not retain contents
+void _buf_release(struct buffer *buf, size_t size) {
+#if MIRROR
+	// this is the only place where a mirror is remapped smaller
+	if (buf->mirror && buf->alloc > mirror_size(size)) {
+		u8_t *mem = mirror_alloc(buf->pool, mirror_size(size));
+		if (mem) {
+			mirror_free(buf->buf, buf->alloc);
+			buf->buf = mem;
+			buf->alloc = mirror_size(size);
+		}
+	} else
+#endif
+	if (buf->alloc > size && !buf->mirror) {
+		u8_t *mem = pool_alloc(buf->pool, size);
+		if (mem) {
+			pool_free(buf->pool, buf->buf);
+			buf->buf = mem;
+			buf->alloc = size;
+		}
+	}
+	// force pointers reset even if visible size does not change
+	buf->size = 0;
+	_buf_resize(buf, min(size, buf->alloc));
+}
+
 // called with mutex locked to resize, does not retain contents, reverts to original size if fails
 void _buf_resize(struct buffer *buf, size_t size) {
+#if MIRROR
+	// mirror wraps at the end of mapped memory, so it is always all of it: only remap to
+	// grow and otherwise keep the largest mapping until _buf_release
+	if (buf->mirror) size = size > buf->alloc ? mirror_size(size) : buf->alloc;
+#endif
 	if (buf->size == size) return;
-	free(buf->buf);
-	buf->buf = malloc(size);
-	if (!buf->buf) {
-		size    = buf->size;
-		buf->buf= malloc(size);
-		if (!buf->buf) {
-			size = 0;
+#if MIRROR
+	if (buf->mirror && size > buf->alloc) {
+		u8_t *mem = mirror_alloc(buf->pool, size);
+		if (mem) {
+			mirror_free(buf->buf, buf->alloc);
+			buf->buf = mem;
+			buf->alloc = size;
+		} else {
+			size = buf->size;
+		}
+	} else
+#endif
+	// shrinking or growing within allocated memory, just change visible size
+	if (size > buf->alloc) {
+		u8_t *mem = pool_alloc(buf->pool, size);
+		if (mem) {
+			pool_free(buf->pool, buf->buf);
+			buf->buf = mem;
+			buf->alloc = size;
+		} else {
+			size = buf->size;
 		}
 	}
 	buf->readp  = buf->buf;
@@ -113,25 +331,64 @@ void _buf_resize(struct buffer *buf, size_t size) {
 	buf->wrap   = buf->buf + size;
 	buf->size   = size;
 	buf->base_size = size;
+	cond_signal(buf->space);
 }
 
-void buf_init(struct buffer *buf, size_t size) {
-	buf->buf    = malloc(size);
+void buf_init_pool(struct buffer *buf, size_t size, struct buf_pool *pool) {
+	buf->pool   = pool;
+	buf->buf    = pool_alloc(pool, size);
+	if (!buf->buf) size = 0;
 	buf->readp  = buf->buf;
 	buf->writep = buf->buf;
 	buf->wrap   = buf->buf + size;
 	buf->size   = size;
 	buf->base_size = size;
+	buf->alloc  = size;
+	buf->mirror = false;
 	mutex_create_p(buf->mutex);
+	cond_create(buf->space);
+}
+
+void buf_init(struct buffer *buf, size_t size) {
+	buf_init_pool(buf, size, NULL);
+}
+
+// falls back to a regular buffer when mirroring is not available
+void buf_init_mirror(struct buffer *buf, size_t size, struct buf_pool *pool) {
+#if MIRROR
+	size = mirror_size(size);
+	buf->buf = mirror_alloc(pool, size);
+	if (buf->buf) {
+		buf->pool   = pool;
+		buf->readp  = buf->buf;
+		buf->writep = buf->buf;
+		buf->wrap   = buf->buf + size;
+		buf->size   = size;
+		buf->base_size = size;
+		buf->alloc  = size;
+		buf->mirror = true;
+		mutex_create_p(buf->mutex);
+		cond_create(buf->space);
+		return;
+	}
+	LOG_WARN("cannot create mirrored buffer (%s)", strerror(errno));
+#endif
+	buf_init_pool(buf, size, pool);
 }
 
 void buf_destroy(struct buffer *buf) {
 	if (buf->buf) {
-		free(buf->buf);
+#if MIRROR
+		if (buf->mirror) mirror_free(buf->buf, buf->alloc);
+		else
+#endif
+		pool_free(buf->pool, buf->buf);
 		buf->buf = NULL;
 		buf->size = 0;
 		buf->base_size = 0;
+		buf->alloc = 0;
 		mutex_destroy(buf->mutex);
+		cond_destroy(buf->space);
 	}
 }
 
@@ -158,4 +415,46 @@ unsigned _buf_write(struct buffer *buf, void *src, unsigned size) {
 	return size;
 }
 
+/*
+ Reserve/commit for the single reader/writer of a buffer: pointers are
+ sampled under the mutex, the copy itself happens unlocked and commit only
+ moves the pointer. The other side may only grow the reserved region, so it
+ stays valid until committed. Flush and resize must not run in-between.
+*/
+u8_t *buf_reserve_read(struct buffer *buf, size_t *size) {
+	u8_t *p;
+
+	mutex_lock(buf->mutex);
+	*size = _buf_contiguous(buf);
+	p = buf->readp;
+	mutex_unlock(buf->mutex);
+
+	return p;
+}
+
+void buf_commit_read(struct buffer *buf, size_t size) {
+	if (!size) return;
+	mutex_lock(buf->mutex);
+	_buf_inc_readp(buf, size);
+	mutex_unlock(buf->mutex);
+}
+
+u8_t *buf_reserve_write(struct buffer *buf, size_t *size) {
+	u8_t *p;
+
+	mutex_lock(buf->mutex);
+	*size = min(_buf_space(buf), _buf_cont_write(buf));
+	p = buf->writep;
+	mutex_unlock(buf->mutex);
+
+	return p;
+}
+
+void buf_commit_write(struct buffer *buf, size_t size) {
+	if (!size) return;
+	mutex_lock(buf->mutex);
+	_buf_inc_writep(buf, size);
+	mutex_unlock(buf->mutex);
+}
+
 
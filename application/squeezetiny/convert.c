@@ -0,0 +1,484 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *  (c) Philippe, philippe_44@outlook.com for raop/multi-instance modifications
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// decoders output to 32 bits interleaved stereo frames, SIMD versions are selected at runtime
+
+#include "squeezelite.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define CONV_X86 1
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define CONV_NEON 1
+#endif
+
+extern log_level 	decode_loglevel;
+static log_level 	*loglevel = &decode_loglevel;
+
+void (*conv_fixed)(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned fracbits);
+void (*conv_s32)(s32_t *optr, s32_t *iptr, size_t frames, unsigned channels, unsigned shift);
+void (*conv_s16)(s32_t *optr, s16_t *iptr, size_t frames, unsigned channels);
+void (*conv_planar)(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned shift);
+void (*conv_mix)(s32_t *iptr, s32_t *cptr, size_t count, s32_t gain_in, s32_t gain_out, u8_t shift);
+
+#define MAX_VAL32 0x7fffffffffffLL
+
+/*
+ Unpacking kernels: expand count input samples to 32 bits samples, mono is
+ duplicated on both channels. Naming is <size><endianness>, big-endian being
+ the "normal" case for LMS. Generic versions are plain loops that compilers
+ can unroll, common 16 bits cases have SSE2/NEON versions
+*/
+#define UNPACK(name, width, expr) 													\
+static void name(u8_t *iptr, u32_t *optr, size_t count) {							\
+	for (; count; count--, iptr += width) *optr++ = expr;  							\
+}																					\
+static void name##_mono(u8_t *iptr, u32_t *optr, size_t count) {					\
+	for (; count; count--, iptr += width, optr += 2) optr[0] = optr[1] = expr;		\
+}
+
+UNPACK(unpack8, 1, (u32_t) iptr[0] << 24)
+UNPACK(unpack8u, 1, (u32_t) (iptr[0] ^ 0x80) << 24)
+UNPACK(unpack16be, 2, (u32_t) iptr[0] << 24 | iptr[1] << 16)
+UNPACK(unpack16le, 2, (u32_t) iptr[1] << 24 | iptr[0] << 16)
+UNPACK(unpack24be, 3, (u32_t) iptr[0] << 24 | iptr[1] << 16 | iptr[2] << 8)
+UNPACK(unpack24le, 3, (u32_t) iptr[2] << 24 | iptr[1] << 16 | iptr[0] << 8)
+UNPACK(unpack32be, 4, (u32_t) iptr[0] << 24 | iptr[1] << 16 | iptr[2] << 8 | iptr[3])
+UNPACK(unpack32le, 4, (u32_t) iptr[3] << 24 | iptr[2] << 16 | iptr[1] << 8 | iptr[0])
+
+// indexed by [channels - 1][in_endian][sample_size / 8 - 1], 16 bits are set by convert_init
+unpack_t conv_unpack[2][2][4] = {
+	{ { unpack8_mono, unpack16be_mono, unpack24be_mono, unpack32be_mono },
+	  { unpack8u_mono, unpack16le_mono, unpack24le_mono, unpack32le_mono } },
+	{ { unpack8, unpack16be, unpack24be, unpack32be },
+	  { unpack8u, unpack16le, unpack24le, unpack32le } },
+};
+
+/*---------------------------------------------------------------------------*/
+// planar fixed point with round and clamp (mad), same channel twice for mono
+static void conv_fixed_c(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned fracbits) {
+	s32_t round = 1L << (fracbits - 24), one = 1L << fracbits;
+	unsigned shift = fracbits + 1 - 24;
+
+	while (frames--) {
+		s32_t l = *left++ + round, r = *right++ + round;
+
+		l = l >= one ? one - 1 : (l < -one ? -one : l);
+		r = r >= one ? one - 1 : (r < -one ? -one : r);
+		*optr++ = (l >> shift) << 8;
+		*optr++ = (r >> shift) << 8;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved mono/stereo left aligned by shift (faad 24 bits)
+static void conv_s32_c(s32_t *optr, s32_t *iptr, size_t frames, unsigned channels, unsigned shift) {
+	if (channels == 2) {
+		for (frames *= 2; frames; frames--) *optr++ = *iptr++ << shift;
+	} else {
+		for (; frames; frames--, optr += 2) optr[0] = optr[1] = *iptr++ << shift;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// interleaved 16 bits mono/stereo, works backward so can be done in place
+static void conv_s16_c(s32_t *optr, s16_t *iptr, size_t frames, unsigned channels) {
+	if (channels == 2) {
+		iptr += frames * 2;
+		optr += frames * 2;
+		for (frames *= 2; frames; frames--) *--optr = *--iptr << 16;
+	} else {
+		iptr += frames;
+		optr += frames * 2;
+		for (; frames; frames--) {
+			optr -= 2;
+			optr[0] = optr[1] = *--iptr << 16;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// planar integer left aligned by shift (flac), same channel twice for mono
+static void conv_planar_c(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned shift) {
+	while (frames--) {
+		*optr++ = *left++ << shift;
+		*optr++ = *right++ << shift;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// mix 2 tracks with gains already including fade, clamps then scales back
+static void mix_c(s32_t *iptr, s32_t *cptr, size_t count, s32_t gain_in, s32_t gain_out, u8_t shift) {
+	while (count--) {
+		s64_t sample = *iptr * (s64_t) gain_in + *cptr++ * (s64_t) gain_out;
+		if (sample > MAX_VAL32) sample = MAX_VAL32;
+		else if (sample < -MAX_VAL32) sample = -MAX_VAL32;
+		*iptr++ = sample >> (16 + shift);
+	}
+}
+
+#if CONV_X86
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse4.1")))
+static void conv_fixed_sse41(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned fracbits) {
+	__m128i round = _mm_set1_epi32(1L << (fracbits - 24));
+	__m128i max = _mm_set1_epi32((1L << fracbits) - 1), min = _mm_set1_epi32(-(1L << fracbits));
+	__m128i shift = _mm_cvtsi32_si128(fracbits + 1 - 24);
+
+	for (; frames >= 4; frames -= 4, left += 4, right += 4, optr += 8) {
+		__m128i l = _mm_loadu_si128((__m128i*) left), r = _mm_loadu_si128((__m128i*) right);
+
+		l = _mm_max_epi32(_mm_min_epi32(_mm_add_epi32(l, round), max), min);
+		r = _mm_max_epi32(_mm_min_epi32(_mm_add_epi32(r, round), max), min);
+		l = _mm_slli_epi32(_mm_sra_epi32(l, shift), 8);
+		r = _mm_slli_epi32(_mm_sra_epi32(r, shift), 8);
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi32(l, r));
+	}
+
+	conv_fixed_c(optr, left, right, frames, fracbits);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void conv_s32_sse2(s32_t *optr, s32_t *iptr, size_t frames, unsigned channels, unsigned shift) {
+	__m128i count = _mm_cvtsi32_si128(shift);
+
+	if (channels == 2) {
+		for (; frames >= 2; frames -= 2, iptr += 4, optr += 4) {
+			_mm_storeu_si128((__m128i*) optr, _mm_sll_epi32(_mm_loadu_si128((__m128i*) iptr), count));
+		}
+	} else {
+		for (; frames >= 4; frames -= 4, iptr += 4, optr += 8) {
+			__m128i v = _mm_sll_epi32(_mm_loadu_si128((__m128i*) iptr), count);
+			_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi32(v, v));
+		}
+	}
+
+	conv_s32_c(optr, iptr, frames, channels, shift);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void conv_s16_sse2(s32_t *optr, s16_t *iptr, size_t frames, unsigned channels) {
+	__m128i zero = _mm_setzero_si128();
+
+	// backward by blocks, each is fully loaded before it can be overwritten
+	if (channels == 2) {
+		for (; frames >= 4; frames -= 4) {
+			__m128i v = _mm_loadu_si128((__m128i*) (iptr + frames * 2 - 8));
+			_mm_storeu_si128((__m128i*) (optr + frames * 2 - 4), _mm_unpackhi_epi16(zero, v));
+			_mm_storeu_si128((__m128i*) (optr + frames * 2 - 8), _mm_unpacklo_epi16(zero, v));
+		}
+	} else {
+		for (; frames >= 4; frames -= 4) {
+			__m128i v = _mm_unpacklo_epi16(zero, _mm_loadl_epi64((__m128i*) (iptr + frames - 4)));
+			_mm_storeu_si128((__m128i*) (optr + frames * 2 - 4), _mm_unpackhi_epi32(v, v));
+			_mm_storeu_si128((__m128i*) (optr + frames * 2 - 8), _mm_unpacklo_epi32(v, v));
+		}
+	}
+
+	conv_s16_c(optr, iptr, frames, channels);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void conv_planar_sse2(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned shift) {
+	__m128i count = _mm_cvtsi32_si128(shift);
+
+	for (; frames >= 4; frames -= 4, left += 4, right += 4, optr += 8) {
+		__m128i l = _mm_sll_epi32(_mm_loadu_si128((__m128i*) left), count);
+		__m128i r = _mm_sll_epi32(_mm_loadu_si128((__m128i*) right), count);
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi32(l, r));
+	}
+
+	conv_planar_c(optr, left, right, frames, shift);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void unpack16le_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+
+	// interleaving zeros below samples is a << 16
+	for (; count >= 8; count -= 8, iptr += 16, optr += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*) iptr);
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi16(zero, v));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi16(zero, v));
+	}
+
+	unpack16le(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void unpack16be_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+
+	for (; count >= 8; count -= 8, iptr += 16, optr += 8) {
+		__m128i v = _mm_loadu_si128((__m128i*) iptr);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi16(zero, v));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi16(zero, v));
+	}
+
+	unpack16be(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void unpack16le_mono_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+
+	for (; count >= 4; count -= 4, iptr += 8, optr += 8) {
+		__m128i v = _mm_unpacklo_epi16(zero, _mm_loadl_epi64((__m128i*) iptr));
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi32(v, v));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi32(v, v));
+	}
+
+	unpack16le_mono(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void unpack16be_mono_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+
+	for (; count >= 4; count -= 4, iptr += 8, optr += 8) {
+		__m128i v = _mm_loadl_epi64((__m128i*) iptr);
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_unpacklo_epi16(zero, v);
+		_mm_storeu_si128((__m128i*) optr, _mm_unpacklo_epi32(v, v));
+		_mm_storeu_si128((__m128i*) (optr + 4), _mm_unpackhi_epi32(v, v));
+	}
+
+	unpack16be_mono(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse4.2")))
+static void mix_sse42(s32_t *iptr, s32_t *cptr, size_t count, s32_t gain_in, s32_t gain_out, u8_t shift) {
+	__m128i gin = _mm_set1_epi32(gain_in), gout = _mm_set1_epi32(gain_out);
+	__m128i max = _mm_set1_epi64x(MAX_VAL32), min = _mm_set1_epi64x(-MAX_VAL32);
+	__m128i sh = _mm_cvtsi32_si128(shift);
+
+	for (; count >= 4; count -= 4, iptr += 4, cptr += 4) {
+		__m128i i = _mm_loadu_si128((__m128i*) iptr), c = _mm_loadu_si128((__m128i*) cptr);
+		// 64 bits products of even then odd samples
+		__m128i e = _mm_add_epi64(_mm_mul_epi32(i, gin), _mm_mul_epi32(c, gout));
+		__m128i o = _mm_add_epi64(_mm_mul_epi32(_mm_srli_epi64(i, 32), gin), _mm_mul_epi32(_mm_srli_epi64(c, 32), gout));
+
+		e = _mm_blendv_epi8(e, max, _mm_cmpgt_epi64(e, max));
+		e = _mm_blendv_epi8(e, min, _mm_cmpgt_epi64(min, e));
+		o = _mm_blendv_epi8(o, max, _mm_cmpgt_epi64(o, max));
+		o = _mm_blendv_epi8(o, min, _mm_cmpgt_epi64(min, o));
+
+		// once clamped, low 32 bits of logical and arithmetic shifts are the same
+		e = _mm_srli_epi64(e, 16);
+		o = _mm_slli_epi64(_mm_srli_epi64(o, 16), 32);
+		_mm_storeu_si128((__m128i*) iptr, _mm_sra_epi32(_mm_blend_epi16(e, o, 0xcc), sh));
+	}
+
+	mix_c(iptr, cptr, count, gain_in, gain_out, shift);
+}
+
+#elif CONV_NEON
+/*---------------------------------------------------------------------------*/
+static void conv_fixed_neon(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned fracbits) {
+	int32x4_t round = vdupq_n_s32(1L << (fracbits - 24));
+	int32x4_t max = vdupq_n_s32((1L << fracbits) - 1), min = vdupq_n_s32(-(1L << fracbits));
+	int32x4_t shift = vdupq_n_s32(-(int) (fracbits + 1 - 24));
+
+	for (; frames >= 4; frames -= 4, left += 4, right += 4, optr += 8) {
+		int32x4x2_t v;
+
+		v.val[0] = vmaxq_s32(vminq_s32(vaddq_s32(vld1q_s32(left), round), max), min);
+		v.val[1] = vmaxq_s32(vminq_s32(vaddq_s32(vld1q_s32(right), round), max), min);
+		v.val[0] = vshlq_n_s32(vshlq_s32(v.val[0], shift), 8);
+		v.val[1] = vshlq_n_s32(vshlq_s32(v.val[1], shift), 8);
+		vst2q_s32(optr, v);
+	}
+
+	conv_fixed_c(optr, left, right, frames, fracbits);
+}
+
+/*---------------------------------------------------------------------------*/
+static void conv_s32_neon(s32_t *optr, s32_t *iptr, size_t frames, unsigned channels, unsigned shift) {
+	int32x4_t count = vdupq_n_s32(shift);
+
+	if (channels == 2) {
+		for (; frames >= 2; frames -= 2, iptr += 4, optr += 4) {
+			vst1q_s32(optr, vshlq_s32(vld1q_s32(iptr), count));
+		}
+	} else {
+		for (; frames >= 4; frames -= 4, iptr += 4, optr += 8) {
+			int32x4x2_t v;
+			v.val[0] = v.val[1] = vshlq_s32(vld1q_s32(iptr), count);
+			vst2q_s32(optr, v);
+		}
+	}
+
+	conv_s32_c(optr, iptr, frames, channels, shift);
+}
+
+/*---------------------------------------------------------------------------*/
+static void conv_s16_neon(s32_t *optr, s16_t *iptr, size_t frames, unsigned channels) {
+	// backward by blocks, each is fully loaded before it can be overwritten
+	if (channels == 2) {
+		for (; frames >= 4; frames -= 4) {
+			int16x8_t v = vld1q_s16(iptr + frames * 2 - 8);
+			int32x4_t hi = vshll_n_s16(vget_high_s16(v), 16), lo = vshll_n_s16(vget_low_s16(v), 16);
+			vst1q_s32(optr + frames * 2 - 4, hi);
+			vst1q_s32(optr + frames * 2 - 8, lo);
+		}
+	} else {
+		for (; frames >= 4; frames -= 4) {
+			int32x4x2_t v;
+			v.val[0] = v.val[1] = vshll_n_s16(vld1_s16(iptr + frames - 4), 16);
+			vst2q_s32(optr + frames * 2 - 8, v);
+		}
+	}
+
+	conv_s16_c(optr, iptr, frames, channels);
+}
+
+/*---------------------------------------------------------------------------*/
+static void conv_planar_neon(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned shift) {
+	int32x4_t count = vdupq_n_s32(shift);
+
+	for (; frames >= 4; frames -= 4, left += 4, right += 4, optr += 8) {
+		int32x4x2_t v;
+		v.val[0] = vshlq_s32(vld1q_s32(left), count);
+		v.val[1] = vshlq_s32(vld1q_s32(right), count);
+		vst2q_s32(optr, v);
+	}
+
+	conv_planar_c(optr, left, right, frames, shift);
+}
+/*---------------------------------------------------------------------------*/
+static void unpack16le_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	for (; count >= 8; count -= 8, iptr += 16, optr += 8) {
+		uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(iptr));
+		vst1q_u32(optr, vshll_n_u16(vget_low_u16(v), 16));
+		vst1q_u32(optr + 4, vshll_n_u16(vget_high_u16(v), 16));
+	}
+
+	unpack16le(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+static void unpack16be_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	for (; count >= 8; count -= 8, iptr += 16, optr += 8) {
+		uint16x8_t v = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(iptr)));
+		vst1q_u32(optr, vshll_n_u16(vget_low_u16(v), 16));
+		vst1q_u32(optr + 4, vshll_n_u16(vget_high_u16(v), 16));
+	}
+
+	unpack16be(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+static void unpack16le_mono_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	for (; count >= 4; count -= 4, iptr += 8, optr += 8) {
+		uint32x4x2_t v;
+		v.val[0] = v.val[1] = vshll_n_u16(vreinterpret_u16_u8(vld1_u8(iptr)), 16);
+		vst2q_u32(optr, v);
+	}
+
+	unpack16le_mono(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+static void unpack16be_mono_simd(u8_t *iptr, u32_t *optr, size_t count) {
+	for (; count >= 4; count -= 4, iptr += 8, optr += 8) {
+		uint32x4x2_t v;
+		v.val[0] = v.val[1] = vshll_n_u16(vreinterpret_u16_u8(vrev16_u8(vld1_u8(iptr))), 16);
+		vst2q_u32(optr, v);
+	}
+
+	unpack16be_mono(iptr, optr, count);
+}
+
+/*---------------------------------------------------------------------------*/
+static void mix_neon(s32_t *iptr, s32_t *cptr, size_t count, s32_t gain_in, s32_t gain_out, u8_t shift) {
+	int32x2_t gin = vdup_n_s32(gain_in), gout = vdup_n_s32(gain_out);
+	int32x4_t sh = vdupq_n_s32(-(int) shift);
+
+	for (; count >= 4; count -= 4, iptr += 4, cptr += 4) {
+		int32x4_t i = vld1q_s32(iptr), c = vld1q_s32(cptr);
+		int64x2_t lo = vmlal_s32(vmull_s32(vget_low_s32(i), gin), vget_low_s32(c), gout);
+		int64x2_t hi = vmlal_s32(vmull_s32(vget_high_s32(i), gin), vget_high_s32(c), gout);
+		// saturating narrow is the same as clamping to MAX_VAL32 before shift
+		vst1q_s32(iptr, vshlq_s32(vcombine_s32(vqshrn_n_s64(lo, 16), vqshrn_n_s64(hi, 16)), sh));
+	}
+
+	mix_c(iptr, cptr, count, gain_in, gain_out, shift);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+void convert_init(void) {
+	char *type = "generic";
+
+	conv_fixed = conv_fixed_c;
+	conv_s32 = conv_s32_c;
+	conv_s16 = conv_s16_c;
+	conv_planar = conv_planar_c;
+	conv_mix = mix_c;
+
+#if CONV_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		conv_s32 = conv_s32_sse2;
+		conv_s16 = conv_s16_sse2;
+		conv_planar = conv_planar_sse2;
+		conv_unpack[0][0][1] = unpack16be_mono_simd;
+		conv_unpack[0][1][1] = unpack16le_mono_simd;
+		conv_unpack[1][0][1] = unpack16be_simd;
+		conv_unpack[1][1][1] = unpack16le_simd;
+		type = "sse2";
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		conv_fixed = conv_fixed_sse41;
+		type = "sse4.1";
+	}
+	if (__builtin_cpu_supports("sse4.2")) {
+		conv_mix = mix_sse42;
+		type = "sse4.2";
+	}
+#elif CONV_NEON
+	conv_fixed = conv_fixed_neon;
+	conv_s32 = conv_s32_neon;
+	conv_s16 = conv_s16_neon;
+	conv_planar = conv_planar_neon;
+	conv_mix = mix_neon;
+	conv_unpack[0][0][1] = unpack16be_mono_simd;
+	conv_unpack[0][1][1] = unpack16le_mono_simd;
+	conv_unpack[1][0][1] = unpack16be_simd;
+	conv_unpack[1][1][1] = unpack16le_simd;
+	type = "neon";
+#endif
+
+	LOG_INFO("using %s samples conversion", type);
+}
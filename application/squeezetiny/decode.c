@@ -31,6 +31,17 @@ static log_level 	*loglevel = &decode_loglevel;
 
 struct codec	*codecs[MAX_CODECS];
 
+// optional shared workers decoding for all players instead of one thread each
+static struct {
+	mutex_type 	mutex;
+	cond_type	ready;		// a player has been queued
+	cond_type	idle;		// a worker released a player
+	struct thread_ctx_s *head, *tail;	// runnable players
+	thread_type *threads;
+	int 		count;
+	bool 		running;
+} pool;
+
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
@@ -50,66 +61,83 @@ struct codec	*codecs[MAX_CODECS];
 
 
 /*---------------------------------------------------------------------------*/
-static void *decode_thread(struct thread_ctx_s *ctx) {
-	while (ctx->decode_running) {
-		size_t bytes, space, min_space;
-		bool toend;
-		bool ran = false;
-
-		LOCK_S;
-		bytes = _buf_used(ctx->streambuf);
-		toend = (ctx->stream.state <= DISCONNECT);
-		UNLOCK_S;
-		LOCK_O;
-		space = _buf_space(ctx->outputbuf);
-		UNLOCK_O;
+// outputbuf fill level (per mil) when decoder can run, -1 otherwise
+static int decode_level(struct thread_ctx_s *ctx) {
+	size_t bytes, space, used, min_space;
+	bool toend;
+
+	if (ctx->decode.state != DECODE_RUNNING || !ctx->codec) return -1;
+
+	LOCK_S;
+	bytes = _buf_used(ctx->streambuf);
+	toend = (ctx->stream.state <= DISCONNECT);
+	UNLOCK_S;
+	LOCK_O;
+	space = _buf_space(ctx->outputbuf);
+	used = _buf_used(ctx->outputbuf);
+	UNLOCK_O;
+
+	LOG_SDEBUG("streambuf bytes: %u outputbuf space: %u", bytes, space);
+
+	IF_DIRECT(
+		min_space = ctx->codec->min_space;
+	);
+	IF_PROCESS(
+		min_space = ctx->process.max_out_frames * BYTES_PER_FRAME;
+	);
 
-		LOCK_D;
+	if (space <= min_space || (bytes <= ctx->codec->min_read_bytes && !toend)) return -1;
 
-		if (ctx->decode.state == DECODE_RUNNING && ctx->codec) {
+	// shared pass-through only needs decoder to detect end of stream
+	if (ctx->output.shared && !toend) return -1;
 
-			LOG_SDEBUG("streambuf bytes: %u outputbuf space: %u", bytes, space);
+	return ((u64_t) used * 1000) / (used + space);
+}
 
-			IF_DIRECT(
-				min_space = ctx->codec->min_space;
-			);
-			IF_PROCESS(
-				min_space = ctx->process.max_out_frames * BYTES_PER_FRAME;
-			);
+/*---------------------------------------------------------------------------*/
+static bool decode_step(struct thread_ctx_s *ctx) {
+	bool ran = false;
 
-			if (space > min_space && (bytes > ctx->codec->min_read_bytes || toend)) {
+	LOCK_D;
 
-				ctx->decode.state = ctx->codec->decode(ctx);
+	if (decode_level(ctx) >= 0) {
 
-				IF_PROCESS(
-					if (ctx->process.in_frames) {
-						process_samples(ctx);
-					}
+		ctx->decode.state = ctx->codec->decode(ctx);
 
-					if (ctx->decode.state == DECODE_COMPLETE) {
-						process_drain(ctx);
-					}
-				);
+		IF_PROCESS(
+			if (ctx->process.in_frames) {
+				process_samples(ctx);
+			}
 
-				if (ctx->decode.state != DECODE_RUNNING) {
+			if (ctx->decode.state == DECODE_COMPLETE) {
+				process_drain(ctx);
+			}
+		);
 
-					LOG_INFO("decode %s", ctx->decode.state == DECODE_COMPLETE ? "complete" : "error");
+		if (ctx->decode.state != DECODE_RUNNING) {
 
-					LOCK_O;
-					if (ctx->output.fade_mode) _checkfade(false, ctx);
-					_checkduration(ctx->decode.frames, ctx);
-					UNLOCK_O;
+			LOG_INFO("decode %s", ctx->decode.state == DECODE_COMPLETE ? "complete" : "error");
 
-					wake_controller(ctx);
-				}
+			LOCK_O;
+			if (ctx->output.fade_mode) _checkfade(false, ctx);
+			_checkduration(ctx->decode.frames, ctx);
+			UNLOCK_O;
 
-				ran = true;
-			}
+			wake_controller(ctx);
 		}
 
-		UNLOCK_D;
+		ran = true;
+	}
 
-		if (!ran) {
+	UNLOCK_D;
+
+	return ran;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *decode_thread(struct thread_ctx_s *ctx) {
+	while (ctx->decode_running) {
+		if (!decode_step(ctx)) {
 			usleep(100000);
 		}
 	}
@@ -117,11 +145,99 @@ static void *decode_thread(struct thread_ctx_s *ctx) {
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+// pool mutex must be held
+static void _queue_player(struct thread_ctx_s *ctx) {
+	if (ctx->decode.queued) return;
+
+	ctx->decode.queued = true;
+	ctx->decode.next = NULL;
+	if (pool.tail) pool.tail->decode.next = ctx;
+	else pool.head = ctx;
+	pool.tail = ctx;
+}
 
 /*---------------------------------------------------------------------------*/
-void decode_init(void) {
+// pool mutex must be held
+static void _unqueue_player(struct thread_ctx_s *ctx) {
+	struct thread_ctx_s **p, *prev = NULL;
+
+	if (!ctx->decode.queued) return;
+
+	for (p = &pool.head; *p != ctx; p = &(*p)->decode.next) prev = *p;
+	*p = ctx->decode.next;
+	if (pool.tail == ctx) pool.tail = prev;
+	ctx->decode.queued = false;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *decode_worker(void *arg) {
+	mutex_lock(pool.mutex);
+
+	while (pool.running) {
+		struct thread_ctx_s *ctx = pool.head;
+		bool ran;
+
+		/*
+		Nothing runnable, wait to be signalled. Should a wake ever be missed,
+		all players are queued again once a second, which costs one useless
+		decode_step for those that can't run
+		*/
+		if (!ctx) {
+			if (cond_timedwait(pool.ready, pool.mutex, 1000)) {
+				int i;
+				for (i = 0; i < thread_ctx.count; i++) {
+					struct thread_ctx_s *p = table_get(&thread_ctx, i);
+					if (p && p->decode_running && !p->decode.busy) _queue_player(p);
+				}
+			}
+			continue;
+		}
+
+		// claim player so that decode_close can't release buffers under our feet
+		_unqueue_player(ctx);
+		ctx->decode.busy = true;
+		ctx->decode.woken = false;
+		mutex_unlock(pool.mutex);
+
+		LOG_SDEBUG("[%p]: worker decoding", ctx);
+		ran = decode_step(ctx);
+
+		mutex_lock(pool.mutex);
+		ctx->decode.busy = false;
+		// keep it runnable while it progresses or if it was woken meanwhile
+		if (ctx->decode_running && (ran || ctx->decode.woken)) _queue_player(ctx);
+		cond_signal(pool.idle);
+	}
+
+	mutex_unlock(pool.mutex);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// streambuf got data, outputbuf got space or decoder was (re)started
+void wake_decode(struct thread_ctx_s *ctx) {
+	if (!pool.count) return;
+
+	mutex_lock(pool.mutex);
+	if (!ctx->decode_running || ctx->decode.queued) ;
+	else if (ctx->decode.busy) ctx->decode.woken = true;
+	else {
+		// one worker is enough for one player
+		_queue_player(ctx);
+		pthread_cond_signal(&pool.ready);
+	}
+	mutex_unlock(pool.mutex);
+}
+
+
+/*---------------------------------------------------------------------------*/
+void decode_init(int workers) {
 	int i = 0;
 
+	convert_init();
+
 #if CODECS
 	codecs[i++] = register_alac();
 	codecs[i++] = register_mad();
@@ -137,11 +253,42 @@ void decode_init(void) {
 	register_soxr();
 #endif
 
+	// decoding workers shared by all players
+	pool.count = workers < 0 ? cpu_count() : workers;
+	pool.running = true;
+	mutex_create(pool.mutex);
+	cond_create(pool.ready);
+	cond_create(pool.idle);
+
+	if (pool.count) {
+		pthread_attr_t attr;
+
+		pool.threads = malloc(pool.count * sizeof(thread_type));
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + DECODE_THREAD_STACK_SIZE);
+		for (i = 0; i < pool.count; i++) {
+			pthread_create(pool.threads + i, &attr, decode_worker, NULL);
+		}
+		pthread_attr_destroy(&attr);
+		LOG_INFO("using %d decoding workers", pool.count);
+	}
 }
 
 
 /*---------------------------------------------------------------------------*/
 void decode_end(void) {
+	int i;
+
+	mutex_lock(pool.mutex);
+	pool.running = false;
+	cond_signal(pool.ready);
+	mutex_unlock(pool.mutex);
+	for (i = 0; i < pool.count; i++) pthread_join(pool.threads[i], NULL);
+	if (pool.count) free(pool.threads);
+	mutex_destroy(pool.mutex);
+	cond_destroy(pool.ready);
+	cond_destroy(pool.idle);
+
 #if CODECS
 	deregister_alac();
 	deregister_vorbis();
@@ -166,10 +313,12 @@ void decode_thread_init(struct thread_ctx_s *ctx) {
 	LOG_DEBUG("[%p]: init decode", ctx);
 	mutex_create(ctx->decode.mutex);
 
-	ctx->decode_running = true;
 	ctx->decode.new_stream = true;
 	ctx->decode.state = DECODE_STOPPED;
 	ctx->decode.handle = NULL;
+	ctx->decode.busy = false;
+	ctx->decode.queued = false;
+	ctx->decode.woken = false;
 #if PROCESS
 	ctx->decode.process_handle = NULL;
 #endif
@@ -179,6 +328,15 @@ void decode_thread_init(struct thread_ctx_s *ctx) {
 		ctx->decode.process = false;
 	);
 
+	// with workers, player is now visible to them
+	if (pool.count) {
+		mutex_lock(pool.mutex);
+		ctx->decode_running = true;
+		mutex_unlock(pool.mutex);
+		return;
+	}
+
+	ctx->decode_running = true;
 	pthread_attr_init(&attr);
 	pthread_attr_setstacksize(&attr, PTHREAD_STACK_MIN + DECODE_THREAD_STACK_SIZE);
 	pthread_create(&ctx->decode_thread, &attr, (void *(*)(void*)) decode_thread, ctx);
@@ -196,7 +354,15 @@ void decode_close(struct thread_ctx_s *ctx) {
 	}
 	ctx->decode_running = false;
 	UNLOCK_D;
-	pthread_join(ctx->decode_thread, NULL);
+
+	if (pool.count) {
+		// no worker can take that player anymore, wait for the one owning it
+		mutex_lock(pool.mutex);
+		while (ctx->decode.busy) cond_timedwait(pool.idle, pool.mutex, 1000);
+		_unqueue_player(ctx);
+		mutex_unlock(pool.mutex);
+	} else pthread_join(ctx->decode_thread, NULL);
+
 	mutex_destroy(ctx->decode.mutex);
 }
 
@@ -228,6 +394,43 @@ unsigned decode_newstream(unsigned sample_rate, int supported_rates[], struct th
 	return sample_rate;
 }
 
+/*---------------------------------------------------------------------------*/
+// find a 16 bits big-endian sync word whose mask covers the whole first byte, memchr
+// skips junk in bulk. When not found, *skip is what can be discarded (a trailing first
+// byte might still start a sync)
+bool sync_find(u8_t *buf, size_t len, u16_t sync, u16_t mask, size_t *skip) {
+	u8_t *p = buf, *end = buf + len;
+
+	while ((p = memchr(p, sync >> 8, end - p)) != NULL && p + 1 < end) {
+		if ((((p[0] << 8) | p[1]) & mask) == sync) {
+			*skip = p - buf;
+			return true;
+		}
+		p++;
+	}
+
+	*skip = p ? (size_t) (p - buf) : len;
+	return false;
+}
+
+/*---------------------------------------------------------------------------*/
+// same for a string marker, keeps a possible partial marker at the end
+bool marker_find(u8_t *buf, size_t len, char *marker, size_t *skip) {
+	size_t n = strlen(marker);
+	u8_t *p = buf, *end = buf + len;
+
+	while ((p = memchr(p, marker[0], end - p)) != NULL && p + n <= end) {
+		if (!memcmp(p, marker, n)) {
+			*skip = p - buf;
+			return true;
+		}
+		p++;
+	}
+
+	*skip = p ? (size_t) (p - buf) : len;
+	return false;
+}
+
 /*---------------------------------------------------------------------------*/
 bool codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	int i;
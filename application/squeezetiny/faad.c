@@ -25,10 +25,6 @@
 
 #define WRAPBUF_LEN 2048
 
-struct chunk_table {
-	u32_t sample, offset;
-};
-
 #if !LINKALL
 struct {
 	void *handle;
@@ -46,20 +42,10 @@ struct {
 struct faad {
 	NeAACDecHandle hAac;
 	u8_t type;
-	// following used for mp4 only
-	u32_t consume;
-	u32_t pos;
-	u32_t sample;
-	u32_t nextchunk;
-	void *stsc;
-	u32_t skip;
-	u64_t samples;
-	u64_t sttssamples;
+	struct mp4 mp4;		// used for mp4 only
 	bool  empty;
-	struct chunk_table *chunkinfo;
 	unsigned long samplerate;
 	unsigned char channels;
-	unsigned trak, play;
 };
 
 extern log_level decode_loglevel;
@@ -87,228 +73,6 @@ static log_level *loglevel = &decode_loglevel;
 #define NEAAC(h, fn, ...) (h)->NeAACDec##fn(__VA_ARGS__)
 #endif
 
-// minimal code for mp4 file parsing to extract audio config and find media data
-
-// adapted from faad2/common/mp4ff
-static u32_t mp4_desc_length(u8_t **buf) {
-	u8_t b;
-	u8_t num_bytes = 0;
-	u32_t length = 0;
-
-	do {
-		b = **buf;
-		*buf += 1;
-		num_bytes++;
-		length = (length << 7) | (b & 0x7f);
-	} while ((b & 0x80) && num_bytes < 4);
-
-	return length;
-}
-
-// read mp4 header to extract config data
-static int read_mp4_header(unsigned long *samplerate_p, unsigned char *channels_p, struct thread_ctx_s *ctx) {
-	struct faad *a = ctx->decode.handle;
-	size_t bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
-	char type[5];
-	u32_t len;
-
-	while (bytes >= 8) {
-		// count trak to find the first playable one
-		u32_t consume;
-
-		len = unpackN((u32_t *)ctx->streambuf->readp);
-		memcpy(type, ctx->streambuf->readp + 4, 4);
-		type[4] = '\0';
-
-		if (!strcmp(type, "moov")) {
-			a->trak = 0;
-			a->play = 0;
-		}
-		if (!strcmp(type, "trak")) {
-			a->trak++;
-		}
-
-		// extract audio config from within esds and pass to DecInit2
-		if (!strcmp(type, "esds") && bytes > len) {
-			unsigned config_len;
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			if (*ptr++ == 0x03) {
-				mp4_desc_length(&ptr);
-				ptr += 4;
-			} else {
-				ptr += 3;
-			}
-			mp4_desc_length(&ptr);
-			ptr += 13;
-			if (*ptr++ != 0x05) {
-				LOG_WARN("[%p]: error parsing esds", ctx);
-				return -1;
-			}
-			config_len = mp4_desc_length(&ptr);
-			if (NEAAC(&ga, Init2, a->hAac, ptr, config_len, samplerate_p, channels_p) == 0) {
-				LOG_DEBUG("[%p]: playable aac track: %u", ctx, a->trak);
-				a->play = a->trak;
-			}
-		}
-
-		// extract the total number of samples from stts
-		if (!strcmp(type, "stts") && bytes > len) {
-			u32_t i;
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			u32_t entries = unpackN((u32_t *)ptr);
-			ptr += 4;
-			for (i = 0; i < entries; ++i) {
-				u32_t count = unpackN((u32_t *)ptr);
-				u32_t size = unpackN((u32_t *)(ptr + 4));
-				a->sttssamples += count * size;
-				ptr += 8;
-			}
-			LOG_DEBUG("[%p]: total number of samples contained in stts: " FMT_u64, ctx, a->sttssamples);
-		}
-
-		// stash sample to chunk info, assume it comes before stco
-		if (!strcmp(type, "stsc") && bytes > len && !a->chunkinfo) {
-			a->stsc = malloc(len - 12);
-			if (a->stsc == NULL) {
-				LOG_WARN("[%p]: malloc fail", ctx);
-				return -1;
-			}
-			memcpy(a->stsc, ctx->streambuf->readp + 12, len - 12);
-		}
-
-		// build offsets table from stco and stored stsc
-		if (!strcmp(type, "stco") && bytes > len && a->play == a->trak) {
-			u32_t i;
-			// extract chunk offsets
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			u32_t entries = unpackN((u32_t *)ptr);
-			ptr += 4;
-			a->chunkinfo = malloc(sizeof(struct chunk_table) * (entries + 1));
-			if (a->chunkinfo == NULL) {
-				LOG_WARN("[%p]: malloc fail", ctx);
-				return -1;
-			}
-			for (i = 0; i < entries; ++i) {
-				a->chunkinfo[i].offset = unpackN((u32_t *)ptr);
-				a->chunkinfo[i].sample = 0;
-				ptr += 4;
-			}
-			a->chunkinfo[i].sample = 0;
-			a->chunkinfo[i].offset = 0;
-			// fill in first sample id for each chunk from stored stsc
-			if (a->stsc) {
-				u32_t stsc_entries = unpackN((u32_t *)a->stsc);
-				u32_t sample = 0;
-				u32_t last = 0, last_samples = 0;
-				u8_t *ptr = (u8_t *)a->stsc + 4;
-				while (stsc_entries--) {
-					u32_t first = unpackN((u32_t *)ptr);
-					u32_t samples = unpackN((u32_t *)(ptr + 4));
-					if (last) {
-						for (i = last - 1; i < first - 1; ++i) {
-							a->chunkinfo[i].sample = sample;
-							sample += last_samples;
-						}
-					}
-					if (stsc_entries == 0) {
-						for (i = first - 1; i < entries; ++i) {
-							a->chunkinfo[i].sample = sample;
-							sample += samples;
-						}
-					}
-					last = first;
-					last_samples = samples;
-					ptr += 12;
-				}
-				free(a->stsc);
-				a->stsc = NULL;
-			}
-		}
-
-		// found media data, advance to start of first chunk and return
-		if (!strcmp(type, "mdat")) {
-			_buf_inc_readp(ctx->streambuf, 8);
-			a->pos += 8;
-			bytes  -= 8;
-			if (a->play) {
-				LOG_DEBUG("[%p]: type: mdat len: %u pos: %u", ctx, len, a->pos);
-				if (a->chunkinfo && a->chunkinfo[0].offset > a->pos) {
-					u32_t skip = a->chunkinfo[0].offset - a->pos; 	
-					LOG_DEBUG("[%p]: skipping: %u", ctx, skip);
-					if (skip <= bytes) {
-						_buf_inc_readp(ctx->streambuf, skip);
-						a->pos += skip;
-					} else {
-						a->consume = skip;
-					}
-				}
-				a->sample = a->nextchunk = 1;
-				return 1;
-			} else {
-				LOG_DEBUG("[%p]: type: mdat len: %u, no playable track found", ctx, len);
-				return -1;
-			}
-		}
-
-		// parse key-value atoms within ilst ---- entries to get encoder padding within iTunSMPB entry for gapless
-		if (!strcmp(type, "----") && bytes > len) {
-			u8_t *ptr = ctx->streambuf->readp + 8;
-			u32_t remain = len - 8, size;
-			if (!memcmp(ptr + 4, "mean", 4) && (size = unpackN((u32_t *)ptr)) < remain) {
-				ptr += size; remain -= size;
-			}
-			if (!memcmp(ptr + 4, "name", 4) && (size = unpackN((u32_t *)ptr)) < remain && !memcmp(ptr + 12, "iTunSMPB", 8)) {
-				ptr += size; remain -= size;
-			}
-			if (!memcmp(ptr + 4, "data", 4) && remain > 16 + 48) {
-				// data is stored as hex strings: 0 start end samples
-				u32_t b, c; u64_t d;
-				if (sscanf((const char *)(ptr + 16), "%x %x %x " FMT_x64, &b, &b, &c, &d) == 4) {
-					LOG_DEBUG("[%p]: iTunSMPB start: %u end: %u samples: " FMT_u64, ctx, b, c, d);
-					if (a->sttssamples && a->sttssamples < b + c + d) {
-						LOG_DEBUG("[%p]: reducing samples as stts count is less", ctx);
-						d = a->sttssamples - (b + c);
-					}
-					a->skip = b;
-					a->samples = d;
-				}
-			}
-		}
-
-		// default to consuming entire box
-		consume = len;
-
-		// read into these boxes so reduce consume
-		if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
-			!strcmp(type, "udta") || !strcmp(type, "ilst")) {
-			consume = 8;
-		}
-		// special cases which mix mix data in the enclosing box which we want to read into
-		if (!strcmp(type, "stsd")) consume = 16;
-		if (!strcmp(type, "mp4a")) consume = 36;
-		if (!strcmp(type, "meta")) consume = 12;
-
-		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
-		if (bytes >= consume) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u", ctx, type, len, consume);
-			_buf_inc_readp(ctx->streambuf, consume);
-			a->pos += consume;
-			bytes -= consume;
-		} else if ( !(!strcmp(type, "esds") || !strcmp(type, "stts") || !strcmp(type, "stsc") ||
-					 !strcmp(type, "stco") || !strcmp(type, "----")) ) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u - partial consume: %u", ctx, type, len, consume, bytes);
-			_buf_inc_readp(ctx->streambuf, bytes);
-			a->pos += bytes;
-			a->consume = consume - bytes;
-			break;
-		} else {
-			break;
-		}
-	}
-
-	return 0;
-}
-
 static decode_state faad_decode(struct thread_ctx_s *ctx) {
 	size_t bytes_total;
 	size_t bytes_wrap;
@@ -320,19 +84,14 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 	LOCK_S;
 	bytes_total = _buf_used(ctx->streambuf);
-	bytes_wrap  = min(bytes_total, _buf_cont_read(ctx->streambuf));
+	bytes_wrap  = min(bytes_total, _buf_contiguous(ctx->streambuf));
 
 	if (ctx->stream.state <= DISCONNECT && !bytes_total) {
 		UNLOCK_S;
 		return DECODE_COMPLETE;
 	}
 
-	if (a->consume) {
-		u32_t consume = min(a->consume, bytes_wrap);
-		LOG_DEBUG("[%p]: consume: %u of %u", ctx, consume, a->consume);
-		_buf_inc_readp(ctx->streambuf, consume);
-		a->pos += consume;
-		a->consume -= consume;
+	if (_mp4_consume(&a->mp4, ctx)) {
 		UNLOCK_S;
 		return DECODE_RUNNING;
 	}
@@ -343,13 +102,14 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 		if (a->type == '2') {
 
 			// adts stream - seek for header
-			while (bytes_wrap >= 2 && (*(ctx->streambuf->readp) != 0xFF || (*(ctx->streambuf->readp + 1) & 0xF6) != 0xF0)) {
-				_buf_inc_readp(ctx->streambuf, 1);
-				bytes_total--;
-				bytes_wrap--;
-			}
+			size_t skip;
+			bool sync = sync_find(ctx->streambuf->readp, bytes_wrap, 0xFFF0, 0xFFF6, &skip);
 
-			if (bytes_wrap >= 2) {
+			_buf_inc_readp(ctx->streambuf, skip);
+			bytes_total -= skip;
+			bytes_wrap -= skip;
+
+			if (sync) {
 				long n = NEAAC(&ga, Init, a->hAac, ctx->streambuf->readp, bytes_wrap, &a->samplerate, &a->channels);
 				if (n < 0) {
 					found = -1;
@@ -361,14 +121,18 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 		} else {
 			// mp4 - read header
-			found = read_mp4_header(&a->samplerate, &a->channels, ctx);
+			found = _mp4_header(&a->mp4, ctx);
+			if (found == 1 && NEAAC(&ga, Init2, a->hAac, a->mp4.config, a->mp4.config_len, &a->samplerate, &a->channels)) {
+				LOG_WARN("[%p]: unable to use esds config", ctx);
+				found = -1;
+			}
 		}
 
 		if (found == 1) {
 
 			LOG_INFO("[%p]: samplerate: %u channels: %u", ctx, a->samplerate, a->channels);
 			bytes_total = _buf_used(ctx->streambuf);
-			bytes_wrap  = min(bytes_total, _buf_cont_read(ctx->streambuf));
+			bytes_wrap  = min(bytes_total, _buf_contiguous(ctx->streambuf));
 
 			LOG_INFO("[%p]: setting track_start", ctx);
 			LOCK_O;
@@ -383,6 +147,12 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 			UNLOCK_O;
 
+			// first chunk is not in streambuf yet
+			if (a->mp4.consume) {
+				UNLOCK_S;
+				return DECODE_RUNNING;
+			}
+
 		} else if (found == -1) {
 
 			LOG_WARN("[%p]: error reading stream header", ctx);
@@ -397,6 +167,7 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 		}
 	}
 
+	// never true when streambuf is mirrored
 	if (bytes_wrap < WRAPBUF_LEN && bytes_total > WRAPBUF_LEN) {
 		// make a local copy of frames which may have wrapped round the end of streambuf
 		u8_t buf[WRAPBUF_LEN];
@@ -412,37 +183,15 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 		LOG_WARN("[%p]: error: %u %s", ctx, info.error, NEAAC(&ga, GetErrorMessage, info.error));
 	}
 
-	endstream = false;
-
-	// mp4 end of chunk - skip to next offset
-	if (a->chunkinfo && a->chunkinfo[a->nextchunk].offset && a->sample++ == a->chunkinfo[a->nextchunk].sample) {
-
-		if (a->chunkinfo[a->nextchunk].offset > a->pos) {
-			u32_t skip = a->chunkinfo[a->nextchunk].offset - a->pos;
-			if (skip != info.bytesconsumed) {
-				LOG_DEBUG("[%p]: skipping to next chunk pos: %u consumed: %u != skip: %u", ctx, a->pos, info.bytesconsumed, skip);
-			}
-			if (bytes_total >= skip) {
-				_buf_inc_readp(ctx->streambuf, skip);
-				a->pos += skip;
-			} else {
-				a->consume = skip;
-			}
-			a->nextchunk++;
-		} else {
-			LOG_ERROR("[%p]: error: need to skip backwards!", ctx);
-			endstream = true;
-		}
-
-	// adts and mp4 when not at end of chunk
-	} else if (info.bytesconsumed != 0) {
-
-		_buf_inc_readp(ctx->streambuf, info.bytesconsumed);
-		a->pos += info.bytesconsumed;
-
 	// error which doesn't advance streambuf - end
-	} else {
+	if (info.bytesconsumed == 0) {
 		endstream = true;
+	} else if (a->type != '2') {
+		// mp4 moves to next chunk offset at end of chunk
+		endstream = !_mp4_next(&a->mp4, info.bytesconsumed, ctx);
+	} else {
+		_buf_inc_readp(ctx->streambuf, info.bytesconsumed);
+		endstream = false;
 	}
 
 	UNLOCK_S;
@@ -459,26 +208,26 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 	frames = info.samples / info.channels;
 
-	if (a->skip) {
+	if (a->mp4.skip) {
 		u32_t skip;
 		if (a->empty) {
 			a->empty = false;
-			a->skip -= frames;
+			a->mp4.skip -= frames;
 			LOG_DEBUG("[%p]: gapless: first frame empty, skipped %u frames at start", ctx, frames);
 		}
-		skip = min(frames, a->skip);
+		skip = min(frames, a->mp4.skip);
 		LOG_DEBUG("[%p]: gapless: skipping %u frames at start", ctx, skip);
 		frames -= skip;
-		a->skip -= skip;
+		a->mp4.skip -= skip;
 		iptr += skip * info.channels;
 	}
 
-	if (a->samples) {
-		if (a->samples < frames) {
-			LOG_DEBUG("[%p]: gapless: trimming %u frames from end", ctx, frames - a->samples);
-			frames = (frames_t)a->samples;
+	if (a->mp4.samples) {
+		if (a->mp4.samples < frames) {
+			LOG_DEBUG("[%p]: gapless: trimming %u frames from end", ctx, frames - a->mp4.samples);
+			frames = (frames_t)a->mp4.samples;
 		}
-		a->samples -= frames;
+		a->mp4.samples -= frames;
 	}
 
 	ctx->decode.frames += frames;
@@ -489,7 +238,6 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 
 	while (frames > 0) {
 		frames_t f;
-		frames_t count;
 		s32_t *optr;
 
 		IF_DIRECT(
@@ -502,18 +250,10 @@ static decode_state faad_decode(struct thread_ctx_s *ctx) {
 		);
 
 		f = min(f, frames);
-		count = f;
 
-		if (info.channels == 2) {
-			while (count--) {
-				*optr++ = *iptr++ << 8;
-				*optr++ = *iptr++ << 8;
-			}
-		} else if (info.channels == 1) {
-			while (count--) {
-				*optr++ = *iptr;
-				*optr++ = *iptr++;
-			}
+		if (info.channels == 2 || info.channels == 1) {
+			conv_s32(optr, iptr, f, info.channels, 8);
+			iptr += f * info.channels;
 		} else {
 			LOG_WARN("[%^p]: unsupported number of channels", ctx);
 		}
@@ -541,22 +281,15 @@ static void faad_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 	if (!a) {
 		a = ctx->decode.handle = malloc(sizeof(struct faad));
 		if (!a) return;
-		a->hAac = a->chunkinfo = a->stsc = NULL;
+		a->hAac = NULL;
+		memset(&a->mp4, 0, sizeof(struct mp4));
 	}
 
 	// a bit of a hack here b/c sample size is not really a sample_size in that case
 	LOG_INFO("[%p]: opening %s stream", ctx, sample_size == '2' ? "adts" : "mp4");
 
 	a->type = sample_size;
-	a->pos = a->consume = a->sample = a->nextchunk = 0;
-
-	if (a->chunkinfo) free(a->chunkinfo);
-	if (a->stsc) free(a->stsc);
-	a->chunkinfo = NULL;
-	a->stsc = NULL;
-	a->skip = 0;
-	a->samples = 0;
-	a->sttssamples = 0;
+	mp4_init(&a->mp4, MP4_FOURCC('m','p','4','a'));
 	a->empty = false;
 
 	if (a->hAac) {
@@ -580,14 +313,7 @@ static void faad_close(struct thread_ctx_s *ctx) {
 
 	NEAAC(&ga, Close, a->hAac);
 	a->hAac = NULL;
-	if (a->chunkinfo) {
-		free(a->chunkinfo);
-		a->chunkinfo = NULL;
-	}
-	if (a->stsc) {
-		free(a->stsc);
-		a->stsc = NULL;
-	}
+	mp4_close(&a->mp4);
 	free(a);
 	ctx->decode.handle = NULL;
 }
@@ -51,6 +51,11 @@ static struct {
 
 struct flac {
 	FLAC__StreamDecoder *decoder;
+#if PROCESS
+	// end of a block that did not fit in process inbuf, sent by next decode steps
+	s32_t *carry;
+	frames_t carry_size, carry_pos, carry_frames;
+#endif
 };
 
 extern log_level decode_loglevel;
@@ -60,17 +65,6 @@ static log_level *loglevel = &decode_loglevel;
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
-#if PROCESS
-#define LOCK_O_direct   if (ctx->decode.direct) mutex_lock(ctx->outputbuf->mutex)
-#define UNLOCK_O_direct if (ctx->decode.direct) mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    if (ctx->decode.direct) { x }
-#define IF_PROCESS(x)   if (!ctx->decode.direct) { x }
-#else
-#define LOCK_O_direct   mutex_lock(ctx->outputbuf->mutex)
-#define UNLOCK_O_direct mutex_unlock(ctx->outputbuf->mutex)
-#define IF_DIRECT(x)    { x }
-#define IF_PROCESS(x)
-#endif
 
 #if LINKALL
 #define FLAC(h, fn, ...) (FLAC__ ## fn)(__VA_ARGS__)
@@ -86,7 +80,7 @@ static FLAC__StreamDecoderReadStatus read_cb(const FLAC__StreamDecoder *decoder,
 	struct thread_ctx_s *ctx = (struct thread_ctx_s*) client_data;
 
 	LOCK_S;
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	bytes = _buf_contiguous(ctx->streambuf);
 	bytes = min(bytes, *want);
 	end = (ctx->stream.state <= DISCONNECT && bytes == 0);
 
@@ -107,8 +101,8 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 	unsigned bits_per_sample = frame->header.bits_per_sample;
 	unsigned channels = frame->header.channels;
 
-	FLAC__int32 *lptr = (FLAC__int32 *)buffer[0];
-	FLAC__int32 *rptr = (FLAC__int32 *)buffer[channels > 1 ? 1 : 0];
+	s32_t *lptr = (s32_t *)buffer[0];
+	s32_t *rptr = (s32_t *)buffer[channels > 1 ? 1 : 0];
 
 	if (ctx->decode.new_stream) {
     	LOG_INFO("[%p]: setting track_start", ctx);
@@ -127,62 +121,56 @@ static FLAC__StreamDecoderWriteStatus write_cb(const FLAC__StreamDecoder *decode
 
 	ctx->decode.frames += frames;
 
-	LOCK_O_direct;
+#if PROCESS
+	// outputbuf space is only checked for one process run per decode step, so blocks larger
+	// than inbuf are not processed at once: the rest is converted aside for next steps
+	if (!ctx->decode.direct) {
+		struct flac *f = ctx->decode.handle;
+		frames_t n = min(frames, ctx->process.max_in_frames - ctx->process.in_frames);
+
+		// samples are right aligned whatever bits_per_sample is (4 to 32)
+		conv_planar((s32_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME),
+					lptr, rptr, n, 32 - bits_per_sample);
+		ctx->process.in_frames += n;
+		frames -= n;
+
+		if (frames > f->carry_size) {
+			s32_t *carry = realloc(f->carry, frames * BYTES_PER_FRAME);
+			if (!carry) {
+				LOG_ERROR("[%p]: no memory to carry %u frames", ctx, frames);
+				return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+			}
+			f->carry = carry;
+			f->carry_size = frames;
+		}
+
+		if (frames) conv_planar(f->carry, lptr + n, rptr + n, frames, 32 - bits_per_sample);
+		f->carry_frames = frames;
+		f->carry_pos = 0;
+
+		return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+	}
+#endif
+
+	LOCK_O;
 
 	while (frames > 0) {
-		frames_t f;
-		frames_t count;
-		s32_t *optr;
-
-		IF_DIRECT(
-			optr = (s32_t *)ctx->outputbuf->writep;
-			f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-		);
-		IF_PROCESS(
-			optr = (s32_t *)ctx->process.inbuf;
-			f = ctx->process.max_in_frames;
-		);
+		s32_t *optr = (s32_t *)ctx->outputbuf->writep;
+		frames_t f = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
 
 		f = min(f, frames);
 
-		count = f;
-
-		if (bits_per_sample == 8) {
-			while (count--) {
-				*optr++ = *lptr++ << 24;
-				*optr++ = *rptr++ << 24;
-			}
-		} else if (bits_per_sample == 16) {
-			while (count--) {
-				*optr++ = *lptr++ << 16;
-				*optr++ = *rptr++ << 16;
-			}
-		} else if (bits_per_sample == 24) {
-			while (count--) {
-				*optr++ = *lptr++ << 8;
-				*optr++ = *rptr++ << 8;
-			}
-		} else if (bits_per_sample == 32) {
-			while (count--) {
-				*optr++ = *lptr++;
-				*optr++ = *rptr++;
-			}
-		} else {
-			LOG_ERROR("[%p]: unsupported bits per sample: %u", ctx, bits_per_sample);
-		}
+		// samples are right aligned whatever bits_per_sample is (4 to 32)
+		conv_planar(optr, lptr, rptr, f, 32 - bits_per_sample);
+		lptr += f;
+		rptr += f;
 
 		frames -= f;
 
-		IF_DIRECT(
-			_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
-		);
-		IF_PROCESS(
-			ctx->process.in_frames = f;
-			if (frames) LOG_ERROR("[%p]: unhandled case", ctx);
-		);
+		_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
 	}
 
-	UNLOCK_O_direct;
+	UNLOCK_O;
 
 	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -198,11 +186,15 @@ static void flac_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t e
 
 	if (!f) {
 		f = ctx->decode.handle = malloc(sizeof(struct flac));
-		f->decoder = NULL;
+		if (f) memset(f, 0, sizeof(struct flac));
 	}
 
 	if (!f) return;
 
+#if PROCESS
+	f->carry_frames = 0;
+#endif
+
 	if (f->decoder) {
 		FLAC(&gf, stream_decoder_reset, f->decoder);
 	} else {
@@ -216,19 +208,45 @@ static void flac_close(struct thread_ctx_s *ctx) {
 	struct flac *f = ctx->decode.handle;
 
 	FLAC(&gf, stream_decoder_delete, f->decoder);
+#if PROCESS
+	free(f->carry);
+#endif
 	free(ctx->decode.handle);
 	ctx->decode.handle = NULL;
 }
 
 static decode_state flac_decode(struct thread_ctx_s *ctx) {
 	struct flac *f = ctx->decode.handle;
-	bool ok = FLAC(&gf, stream_decoder_process_single, f->decoder);
-	FLAC__StreamDecoderState state = FLAC(&gf, stream_decoder_get_state, f->decoder);
+	bool ok;
+	FLAC__StreamDecoderState state;
+
+#if PROCESS
+	// finish previous block before decoding a new one
+	if (f->carry_frames) {
+		frames_t n = min(f->carry_frames, ctx->process.max_in_frames - ctx->process.in_frames);
+
+		memcpy((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME,
+			   f->carry + f->carry_pos * 2, n * BYTES_PER_FRAME);
+		ctx->process.in_frames += n;
+		f->carry_pos += n;
+		f->carry_frames -= n;
+
+		return DECODE_RUNNING;
+	}
+#endif
+
+	ok = FLAC(&gf, stream_decoder_process_single, f->decoder);
+	state = FLAC(&gf, stream_decoder_get_state, f->decoder);
 
 	if (!ok && state != FLAC__STREAM_DECODER_END_OF_STREAM) {
 		LOG_INFO("flac error: %s", FLAC_A(&gf, StreamDecoderStateString)[state]);
 	};
 
+#if PROCESS
+	// last block is not complete until carry has been sent
+	if (f->carry_frames && state == FLAC__STREAM_DECODER_END_OF_STREAM) return DECODE_RUNNING;
+#endif
+
 	if (state == FLAC__STREAM_DECODER_END_OF_STREAM) {
 		return DECODE_COMPLETE;
 	} else if (state > FLAC__STREAM_DECODER_END_OF_STREAM) {
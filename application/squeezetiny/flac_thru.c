@@ -132,52 +132,80 @@ static u8_t flac_header[] = {
 struct flac {
 	flac_streaminfo_t *streaminfo;
 	u32_t sample_rate;
+	bool started;
 };
 
 static u16_t 	flac_block_size(u8_t block_size);
 static bool 	create_streaminfo(flac_frame_t *frame, flac_streaminfo_t *streaminfo, u32_t *rate);
 
+/*---------------------------------------------------------------------------*/
+// original sample rate from STREAMINFO or from 1st frame (0 if not coded there)
+static u32_t flac_rate(u8_t *h, size_t len) {
+	if (len >= 21 && !memcmp(h, "fLaC", 4) && (h[4] & 0x7f) == 0) return (h[18] << 12) | (h[19] << 4) | (h[20] >> 4);
+	if (len >= 3 && h[0] == 0xff && (h[1] & 0xfe) == 0xf8) return FLAC_CODED_RATES[h[2] & 0x0f];
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 decode_state flac_decode(struct thread_ctx_s *ctx) {
-	size_t in, out;
+	size_t in, out, used;
+	u8_t *iptr, *optr;
 	struct flac *p = ctx->decode.handle;
+	bool eos;
 
 	LOCK_S;
-	LOCK_O_direct;
+	eos = ctx->stream.state <= DISCONNECT;
+	used = _buf_used(ctx->streambuf);
+	UNLOCK_S;
 
-	in = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	iptr = buf_reserve_read(ctx->streambuf, &in);
+	in = min(in, used);
 
-	if (ctx->stream.state <= DISCONNECT && in == 0) {
-		UNLOCK_O_direct;
-		UNLOCK_S;
-		return DECODE_COMPLETE;
-	}
+	if (eos && in == 0) return DECODE_COMPLETE;
 
 	// need to do that before header increments pointer
-	if (ctx->decode.new_stream) ctx->output.track_start = ctx->outputbuf->writep;
+	if (ctx->decode.new_stream) {
+		LOG_INFO("[%p]: setting track_start", ctx);
+		LOCK_O;
+		ctx->output.track_start = ctx->outputbuf->writep;
+		UNLOCK_O;
+		ctx->decode.new_stream = false;
+	}
 
 	// the min in and out are enough to process a full header
 	if (p->streaminfo) {
 		flac_frame_t frame;
-		size_t bytes;
+		size_t bytes, skip, at;
+		bool found = marker_find(iptr, in, "fLaC", &skip);
+
+		// drop junk before "fLaC" or 1st frame, marker first as tags may contain sync-like bytes
+		if (!found) {
+			found = sync_find(iptr, in, 0xFFF8, 0xFFFE, &at);
+			skip = found ? at : min(skip, at);
+		}
+
+		if (skip) {
+			LOG_INFO("[%p]: skipping %zu bytes of junk", ctx, skip);
+			buf_commit_read(ctx->streambuf, skip);
+			used -= skip;
+			iptr = buf_reserve_read(ctx->streambuf, &in);
+			in = min(in, used);
+		}
+
+		// a whole frame header is needed, might be across the wrap
+		if ((!found || used < sizeof(frame)) && !eos) return DECODE_RUNNING;
 
 		// acquire a full header, do not increment pointer
 		bytes = min(in, sizeof(frame));
-		memcpy(&frame, ctx->streambuf->readp, bytes);
+		memcpy(&frame, iptr, bytes);
 		memcpy((u8_t*) &frame + bytes, ctx->streambuf->buf, sizeof(frame) - bytes);
 
 		// starting with "flAC", we have a full header, no need to to anything
 		if (strncmp((char*) &frame, "fLaC", 4) && create_streaminfo(&frame, p->streaminfo, &p->sample_rate)) {
-			bytes = min(sizeof(flac_header), _buf_cont_write(ctx->outputbuf));
-			memcpy(ctx->outputbuf->writep, &flac_header, bytes);
-			memcpy(ctx->outputbuf->buf, (u8_t*) &flac_header + bytes, sizeof(flac_header) - bytes);
-			_buf_inc_writep(ctx->outputbuf, sizeof(flac_header));
-
-			bytes = min(sizeof(flac_streaminfo_t), _buf_cont_write(ctx->outputbuf));
-			memcpy(ctx->outputbuf->writep, p->streaminfo, bytes);
-			memcpy(ctx->outputbuf->buf, (u8_t*) p->streaminfo + bytes, sizeof(flac_streaminfo_t) - bytes);
-			_buf_inc_writep(ctx->outputbuf, sizeof(flac_streaminfo_t));
-
+			LOCK_O;
+			_buf_write(ctx->outputbuf, flac_header, sizeof(flac_header));
+			_buf_write(ctx->outputbuf, p->streaminfo, sizeof(flac_streaminfo_t));
+			UNLOCK_O;
 			LOG_INFO("[%p]: FLAC header added", ctx);
 		}
 
@@ -185,21 +213,33 @@ decode_state flac_decode(struct thread_ctx_s *ctx) {
 		p->streaminfo = NULL;
 	}
 
-	if (ctx->decode.new_stream) {
-		LOG_INFO("[%p]: setting track_start", ctx);
-		ctx->decode.new_stream = false;
+	// only the original sample rate is needed from the stream, it's sent untouched
+	if (!p->started) {
+		u8_t h[21];
+		size_t bytes = min(used, sizeof(h)), n = min(in, bytes);
+
+		if (used < sizeof(h) && !eos) return DECODE_RUNNING;
+
+		memcpy(h, iptr, n);
+		memcpy(h + n, ctx->streambuf->buf, bytes - n);
+		if (!p->sample_rate) p->sample_rate = flac_rate(h, bytes);
+
+		if (p->sample_rate) {
+			LOCK_O;
+			ctx->output.direct_sample_rate = p->sample_rate;
+			UNLOCK_O;
+		}
+
+		p->started = true;
 	}
 
-	out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf));
+	optr = buf_reserve_write(ctx->outputbuf, &out);
 	out = min(in, out);
 
-	memcpy(ctx->outputbuf->writep, ctx->streambuf->readp, out);
+	memcpy(optr, iptr, out);
 
-	_buf_inc_readp(ctx->streambuf, out);
-	_buf_inc_writep(ctx->outputbuf, out);
-
-	UNLOCK_O_direct;
-	UNLOCK_S;
+	buf_commit_read(ctx->streambuf, out);
+	buf_commit_write(ctx->outputbuf, out);
 
 	return DECODE_RUNNING;
 }
@@ -208,17 +248,20 @@ decode_state flac_decode(struct thread_ctx_s *ctx) {
 static void flac_open(u8_t sample_size, u32_t sample_rate, u8_t	channels, u8_t endianness, struct thread_ctx_s *ctx) {
 	struct flac *p = ctx->decode.handle;
 
-	if (!p)	p = ctx->decode.handle = malloc(sizeof(struct flac));
+	if (!p)	p = ctx->decode.handle = calloc(1, sizeof(struct flac));
 
 	if (!p) return;
 
+	if (p->streaminfo) free(p->streaminfo);
+	memset(p, 0, sizeof(struct flac));
+
 	if (ctx->config.flac_header != FLAC_NO_HEADER) {
 		p->streaminfo = malloc(sizeof(flac_streaminfo_t));
 		if (ctx->config.flac_header == FLAC_NORMAL_HEADER)
 			memcpy(p->streaminfo, &FLAC_NORMAL_STREAMINFO, sizeof(flac_streaminfo_t));
 		else
 			memcpy(p->streaminfo, &FLAC_FULL_STREAMINFO, sizeof(flac_streaminfo_t));
-	} else p->streaminfo = NULL;
+	}
 }
 
 /*---------------------------------------------------------------------------*/
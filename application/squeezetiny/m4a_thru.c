@@ -25,15 +25,10 @@
 #define WRAPBUF_LEN 2048
 
 struct m4adts {
-	// following used for mp4 only
-	u32_t consume;
-	u32_t pos;
-	u32_t *frames;
-	u32_t frame_size, frame_index;
+	struct mp4 mp4;
 	u8_t freq_index;
 	u32_t audio_object_type;
 	u8_t channel_config;
-	unsigned trak, play;
 };
 
 extern log_level decode_loglevel;
@@ -56,136 +51,28 @@ static log_level *loglevel = &decode_loglevel;
 #endif
 
 
-// read mp4 header to extract config data
-static int read_mp4_header(struct thread_ctx_s *ctx) {
-	struct m4adts *a = ctx->decode.handle;
-	size_t bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
-	char type[5];
-	u32_t len;
-
-	// assume that mP4 header will not wrap around streambuf!
-
-	while (bytes >= 8) {
-		// count trak to find the first playable one
-		u32_t consume;
-
-		len = unpackN((u32_t *)ctx->streambuf->readp);
-		memcpy(type, ctx->streambuf->readp + 4, 4);
-		type[4] = '\0';
-
-		if (!strcmp(type, "moov")) {
-			a->trak = 0;
-			a->play = 0;
-		}
-		if (!strcmp(type, "trak")) {
-			a->trak++;
-		}
-
-		// extract audio config from within esds
-		if (!strcmp(type, "esds") && bytes > len) {
-			u8_t *ptr = ctx->streambuf->readp + 12;
-			u32_t audio_config;
-
-			// handle extension tag if present
-			if (*ptr++ != 0x03) return -1;
-			if (*ptr == 0x80 || *ptr == 0x81 || *ptr == 0xfe) ptr += 3;
-			ptr += 4;
-			if (*ptr++ != 0x04) return -1;
-			if (*ptr == 0x80 || *ptr == 0x81 || *ptr == 0xfe) ptr += 3;
-			ptr += 14;
-			if (*ptr++ != 0x05) return -1;
-			if (*ptr == 0x80 || *ptr == 0x81 || *ptr == 0xfe) ptr += 3;
-			ptr += 1;
-			audio_config = unpackN((u32_t*)ptr);
-			a->freq_index = (audio_config >> 23)& 0x0f;
-			a->audio_object_type = (audio_config >> 27);
-			a->channel_config = (audio_config >> 19)& 0x0f;
-			LOG_DEBUG("[%p]: playable aac track: %u", ctx, a->trak);
-			a->play = a->trak;
-		}
-
-		// stash sample to chunk info, assume it comes before stco
-		if (!strcmp(type, "stsz") && bytes > len) {
-			a->frame_size = unpackN((u32_t*) (ctx->streambuf->readp + 12));
-			if (!a->frame_size) {
-				u32_t entries = unpackN((u32_t*) (ctx->streambuf->readp + 16));
-				u8_t *ptr = ctx->streambuf->readp + 20 + entries * 4;
-
-				a->frames = malloc(entries * 4);
-				a->frame_index = 0;
-				LOG_INFO("[%p]: frame table of %d entries", ctx, entries);
-				while (entries--) {
-					ptr -= 4;
-					a->frames[entries] = unpackN((u32_t*) ptr);
-				}
-			}
-		}
-
-		// found media data, advance to start of first chunk and return
-		if (!strcmp(type, "mdat")) {
-			_buf_inc_readp(ctx->streambuf, 8);
-			a->pos += 8;
-			bytes  -= 8;
-			if (a->play) {
-				LOG_DEBUG("[%p]: type: mdat len: %u pos: %u", ctx, len, a->pos);
-				return 1;
-			} else {
-				// some file have mdat before moov, but we can't seek
-				LOG_ERROR("[%p]: type: mdat len: %u, no playable track found", ctx, len);
-				return -1;
-			}
-		}
-
-		// default to consuming entire box
-		consume = len;
-
-		// read into these boxes so reduce consume
-		if (!strcmp(type, "moov") || !strcmp(type, "trak") || !strcmp(type, "mdia") || !strcmp(type, "minf") || !strcmp(type, "stbl") ||
-			!strcmp(type, "udta") || !strcmp(type, "ilst")) {
-			consume = 8;
-		}
-		// special cases which mix mix data in the enclosing box which we want to read into
-		if (!strcmp(type, "stsd")) consume = 16;
-		if (!strcmp(type, "mp4a")) consume = 36;
-		if (!strcmp(type, "meta")) consume = 12;
-
-		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
-		if (bytes >= consume) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u", ctx, type, len, consume);
-			_buf_inc_readp(ctx->streambuf, consume);
-			a->pos += consume;
-			bytes -= consume;
-		} else if ( !(!strcmp(type, "esds") || !strcmp(type, "stsz") ) ) {
-			LOG_DEBUG("[%p]: type: %s len: %u consume: %u - partial consume: %u", ctx, type, len, consume, bytes);
-			_buf_inc_readp(ctx->streambuf, bytes);
-			a->pos += bytes;
-			a->consume = consume - bytes;
-			break;
-		} else {
-			break;
-		}
-	}
-
-	return 0;
-}
-
 static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 	struct m4adts *a = ctx->decode.handle;
 
 	LOCK_S;
 
-	if (a->consume) {
-		u32_t consume = min(a->consume, _buf_cont_read(ctx->streambuf));
-		LOG_DEBUG("[%p]: consume: %u of %u", ctx, consume, a->consume);
-		_buf_inc_readp(ctx->streambuf, consume);
-		a->pos += consume;
-		a->consume -= consume;
+	if (_mp4_consume(&a->mp4, ctx)) {
 		UNLOCK_S;
 		return DECODE_RUNNING;
 	}
 
 	if (ctx->decode.new_stream) {
-		int found = read_mp4_header(ctx);
+		int found = _mp4_header(&a->mp4, ctx);
+
+		// audio config is the AudioSpecificConfig bitfield
+		if (found == 1 && a->mp4.config_len >= 2) {
+			a->audio_object_type = a->mp4.config[0] >> 3;
+			a->freq_index = ((a->mp4.config[0] & 0x07) << 1) | (a->mp4.config[1] >> 7);
+			a->channel_config = (a->mp4.config[1] >> 3) & 0x0f;
+			LOG_DEBUG("[%p]: playable aac track: %u", ctx, a->mp4.play);
+		} else if (found == 1) {
+			found = -1;
+		}
 
 		if (found == 1) {
 			LOG_INFO("[%p]: setting track_start", ctx);
@@ -194,6 +81,12 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 			ctx->decode.new_stream = false;
 			UNLOCK_O;
 
+			// first chunk is not in streambuf yet
+			if (a->mp4.consume) {
+				UNLOCK_S;
+				return DECODE_RUNNING;
+			}
+
 		} else if (found == -1) {
 			LOG_WARN("[%p]: error reading stream header", ctx);
 			UNLOCK_S;
@@ -218,7 +111,11 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 			return DECODE_COMPLETE;
 		}
 
-		frame_size = a->frame_size ? a->frame_size : a->frames[a->frame_index];
+		// stop at end of sample table, there might be trailing boxes
+		if ((frame_size = mp4_sample_size(&a->mp4)) == 0) {
+			UNLOCK_S;
+			return DECODE_COMPLETE;
+		}
 
 		out = _buf_space(ctx->outputbuf);
 		if (in < frame_size || out < frame_size + sizeof(ADTSHeader)){
@@ -226,8 +123,7 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 			return DECODE_RUNNING;
 		}
 
-		a->frame_index++;
-		in = min(in, _buf_cont_read(ctx->streambuf));
+		in = min(in, _buf_contiguous(ctx->streambuf));
 
 		// simplify copy by handling wrap case
 		if (in < frame_size) {
@@ -257,10 +153,14 @@ static decode_state m4adts_decode(struct thread_ctx_s *ctx) {
 		_buf_inc_writep(ctx->outputbuf, frame_size);
 
 		if (in < frame_size ) free(iptr);
-		_buf_inc_readp(ctx->streambuf, frame_size);
 
 		UNLOCK_O_direct;
-		UNLOCK_S;
+
+		// move to next frame, or next chunk offset at end of chunk
+		if (!_mp4_next(&a->mp4, frame_size, ctx) || a->mp4.consume) {
+			UNLOCK_S;
+			return a->mp4.consume ? DECODE_RUNNING : DECODE_ERROR;
+		}
 
 		LOG_SDEBUG("[%p]: write %u bytes", ctx, frame_size + sizeof(ADTSHeader));
 	}
@@ -272,17 +172,16 @@ static void m4adts_open(u8_t sample_size, u32_t sample_rate, u8_t channels, u8_t
 	if (!a) {
 		a = ctx->decode.handle = malloc(sizeof(struct m4adts));
 		if (!a) return;
-		a->frames = NULL;
+		memset(&a->mp4, 0, sizeof(struct mp4));
 	}
 
-	a->play = a->pos = a->consume = 0;
-	if (a->frames) free(a->frames);
+	mp4_init(&a->mp4, MP4_FOURCC('m','p','4','a'));
 }
 
 static void m4adts_close(struct thread_ctx_s *ctx) {
 	struct m4adts *a = ctx->decode.handle;
 
-	if (a->frames) free(a->frames);
+	mp4_close(&a->mp4);
 	free(a);
 	ctx->decode.handle = NULL;
 }
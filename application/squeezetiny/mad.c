@@ -84,18 +84,6 @@ static log_level *loglevel = &decode_loglevel;
 #define MAD(h, fn, ...) (h)->mad_##fn(__VA_ARGS__)
 #endif
 
-// based on libmad minimad.c scale
-static inline u32_t scale(mad_fixed_t sample) {
-	sample += (1L << (MAD_F_FRACBITS - 24));
-
-	if (sample >= MAD_F_ONE)
-		sample = MAD_F_ONE - 1;
-	else if (sample < -MAD_F_ONE)
-		sample = -MAD_F_ONE;
-
-	return (s32_t)((sample >> (MAD_F_FRACBITS + 1 - 24)) << 8);
-}
-
 // check for id3.2 tag at start of file - http://id3.org/id3v2.4.0-structure, return length
 static unsigned _check_id3_tag(size_t bytes, struct thread_ctx_s *ctx) {
 	u8_t *ptr = ctx->streambuf->readp;
@@ -165,7 +153,7 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 	struct mad *m = ctx->decode.handle;
 
 	LOCK_S;
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	bytes = _buf_contiguous(ctx->streambuf);
 
 	if (m->checktags) {
 		if (m->checktags == 1) {
@@ -181,7 +169,20 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 			return DECODE_RUNNING;
 		}
 		if (m->checktags == 2) {
-			if (!ctx->stream.meta_interval) {
+			// drop junk before 1st frame in bulk instead of letting mad resync byte by byte
+			size_t skip;
+			bool sync = sync_find(ctx->streambuf->readp, bytes, 0xFFE0, 0xFFE0, &skip);
+
+			if (skip) {
+				LOG_DEBUG("[%p]: skipping %zu bytes before sync", ctx, skip);
+				_buf_inc_readp(ctx->streambuf, skip);
+				bytes -= skip;
+			}
+			if (!sync && ctx->stream.state > DISCONNECT) {
+				UNLOCK_S;
+				return DECODE_RUNNING;
+			}
+			if (sync && !ctx->stream.meta_interval) {
 				_check_lame_header(bytes, ctx);
 			}
 			m->checktags = 0;
@@ -303,7 +304,7 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 		LOG_SDEBUG("[%p]: write %u frames", ctx, frames);
 
 		while (frames > 0) {
-			size_t f, count;
+			size_t f;
 			s32_t *optr;
 
 			IF_DIRECT(
@@ -315,12 +316,10 @@ static decode_state mad_decode(struct thread_ctx_s *ctx) {
 				optr = (s32_t *)((u8_t *) ctx->process.inbuf + ctx->process.in_frames * BYTES_PER_FRAME);
 			);
 
-			count = f;
-
-			while (count--) {
-				*optr++ = scale(*iptrl++);
-				*optr++ = scale(*iptrr++);
-			}
+			// based on libmad minimad.c scale
+			conv_fixed(optr, (s32_t*) iptrl, (s32_t*) iptrr, f, MAD_F_FRACBITS);
+			iptrl += f;
+			iptrr += f;
 
 			frames -= f;
 
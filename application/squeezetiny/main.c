@@ -41,7 +41,7 @@
 #define LOCK_P   mutex_lock(ctx->mutex)
 #define UNLOCK_P mutex_unlock(ctx->mutex)
 
-struct thread_ctx_s thread_ctx[MAX_PLAYER];
+table_t thread_ctx;
 char				sq_ip[16];
 u16_t				sq_port;
 
@@ -63,24 +63,25 @@ void sq_wipe_device(struct thread_ctx_s *ctx) {
 	mutex_unlock(ctx->cli_mutex);
 
 	slimproto_close(ctx);
-	output_flush(ctx);
-	output_close(ctx);
+	output_flush(ctx);
 #if RESAMPLE
 	process_end(ctx);
 #endif
+	// decoder uses both buffers, so it must stop first
 	decode_close(ctx);
+	output_close(ctx);
 	stream_close(ctx);
+	buf_pool_destroy(&ctx->buf_pool);
 
 	for (i = 0; ctx->mimetypes[i]; i++) free(ctx->mimetypes[i]);
 }
 
 /*--------------------------------------------------------------------------*/
 void sq_delete_device(sq_dev_handle_t handle) {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 
-	if (!handle) return;
+	if (!ctx) return;
 
-	ctx = &thread_ctx[handle - 1];
 	sq_wipe_device(ctx);
 }
 
@@ -264,12 +265,12 @@ bool cli_open_socket(struct thread_ctx_s *ctx) {
 /*--------------------------------------------------------------------------*/
 u32_t sq_get_time(sq_dev_handle_t handle)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 	char cmd[128];
 	char *rsp;
 	u32_t time = 0;
 
-	if (!ctx->config.dynamic.use_cli) return 0;
+	if (!ctx || !ctx->config.dynamic.use_cli) return 0;
 
 	if (!handle || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
@@ -293,11 +294,11 @@ u32_t sq_get_time(sq_dev_handle_t handle)
 /*---------------------------------------------------------------------------*/
 bool sq_set_time(sq_dev_handle_t handle, char *pos)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 	char cmd[128];
 	char *rsp;
 
-	if (!ctx->config.dynamic.use_cli) return false;
+	if (!ctx || !ctx->config.dynamic.use_cli) return false;
 
 	if (!handle || !ctx->in_use) {
 		LOG_ERROR("[%p]: no handle or cli socket %d", ctx, handle);
@@ -351,12 +352,12 @@ void sq_default_metadata(metadata_t *metadata, bool init)
 /*--------------------------------------------------------------------------*/
 bool sq_get_metadata(sq_dev_handle_t handle, metadata_t *metadata, unsigned offset)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 	char cmd[1024];
 	char *rsp, *p, *cur;
 
-	if (!handle || !ctx->in_use || !ctx->config.dynamic.use_cli) {
-		if (ctx->config.dynamic.use_cli) {
+	if (!ctx || !ctx->in_use || !ctx->config.dynamic.use_cli) {
+		if (ctx && ctx->config.dynamic.use_cli) {
 			LOG_ERROR("[%p]: no handle or CLI socket %d", ctx, handle);
 		}
 		sq_default_metadata(metadata, true);
@@ -500,11 +501,11 @@ void sq_free_metadata(metadata_t *metadata)
 /*--------------------------------------------------------------------------*/
 u32_t sq_self_time(sq_dev_handle_t handle)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 	u32_t time;
 	u32_t now = gettime_ms();
 
-	if (!handle || !ctx->in_use) return 0;
+	if (!ctx || !ctx->in_use) return 0;
 
 	LOCK_O;
 
@@ -522,13 +523,13 @@ u32_t sq_self_time(sq_dev_handle_t handle)
 /*---------------------------------------------------------------------------*/
 void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *cookie, void *param)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
 	char cmd[128], *rsp;
 
 	LOG_SDEBUG("[%p] notif %d", ctx, event);
 
 	// squeezelite device has not started yet or is off ...
-	if (!ctx->running || !ctx->on || !handle || !ctx->in_use) return;
+	if (!ctx || !ctx->running || !ctx->on || !ctx->in_use) return;
 
 	switch (event) {
 		case SQ_TRANSITION:
@@ -701,34 +702,36 @@ void sq_notify(sq_dev_handle_t handle, void *caller_id, sq_event_t event, u8_t *
 
 
 /*---------------------------------------------------------------------------*/
-void sq_init(char *ip, u16_t port)
+void sq_init(char *ip, u16_t port, int decode_workers)
 {
 	strcpy(sq_ip, ip);
 	sq_port = port;
 
+	table_init(&thread_ctx, sizeof(struct thread_ctx_s));
 	output_init();
-	decode_init();
+	decode_init(decode_workers);
 }
 
 /*---------------------------------------------------------------------------*/
 void sq_stop() {
 	int i;
 
-	for (i = 0; i < MAX_PLAYER; i++) {
-		if (thread_ctx[i].in_use) {
-			sq_wipe_device(&thread_ctx[i]);
-		}
+	for (i = 0; i < thread_ctx.count; i++) {
+		struct thread_ctx_s *ctx = table_get(&thread_ctx, i);
+		if (ctx->in_use) sq_wipe_device(ctx);
 	}
 
 	decode_end();
 	output_end();
+	table_free(&thread_ctx);
 }
 
 /*---------------------------------------------------------------------------*/
 void sq_release_device(sq_dev_handle_t handle)
 {
-	if (handle) {
-		struct thread_ctx_s *ctx = thread_ctx + handle - 1;
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
+
+	if (ctx) {
 		int i;
 
 		ctx->in_use = false;
@@ -739,21 +742,24 @@ void sq_release_device(sq_dev_handle_t handle)
 /*---------------------------------------------------------------------------*/
 sq_dev_handle_t sq_reserve_device(void *MR, bool on, char *mimetypes[], sq_callback_t callback)
 {
-	int idx, i;
-	struct thread_ctx_s *ctx;
-
+	int idx, i;
+	struct thread_ctx_s *ctx = NULL;
+
 	/* find a free thread context - this must be called in a LOCKED context */
-	for  (idx = 0; idx < MAX_PLAYER; idx++)
-		if (!thread_ctx[idx].in_use) break;
+	for  (idx = 0; idx < thread_ctx.count; idx++) {
+		ctx = table_get(&thread_ctx, idx);
+		if (!ctx->in_use) break;
+	}
 
-	if (idx < MAX_PLAYER) 	{
+	if (idx < thread_ctx.count) {
 		// this sets a LOT of data to proper defaults (NULL, false ...)
-		memset(&thread_ctx[idx], 0, sizeof(struct thread_ctx_s));
-		thread_ctx[idx].in_use = true;
+		memset(ctx, 0, sizeof(struct thread_ctx_s));
+	} else if ((ctx = table_add(&thread_ctx)) == NULL) {
+		LOG_ERROR("too many players %d", thread_ctx.count);
+		return false;
 	}
-	else return false;
 
-	ctx = thread_ctx + idx;
+	ctx->in_use = true;
 	ctx->self = idx + 1;
 	ctx->on = on;
 	ctx->callback = callback;
@@ -768,7 +774,9 @@ sq_dev_handle_t sq_reserve_device(void *MR, bool on, char *mimetypes[], sq_callb
 /*---------------------------------------------------------------------------*/
 bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 {
-	struct thread_ctx_s *ctx = &thread_ctx[handle - 1];
+	struct thread_ctx_s *ctx = table_get(&thread_ctx, handle - 1);
+
+	if (!ctx) return false;
 
 	memcpy(&ctx->config, param, sizeof(sq_dev_param_t));
 
@@ -780,7 +788,12 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 						  ctx->config.mac[0], ctx->config.mac[1], ctx->config.mac[2],
 				   		  ctx->config.mac[3], ctx->config.mac[4], ctx->config.mac[5]);
 
-	if (!stream_thread_init(ctx)) return false;
+	buf_pool_init(&ctx->buf_pool, ctx->config.lock_memory);
+
+	if (!stream_thread_init(ctx)) {
+		buf_pool_destroy(&ctx->buf_pool);
+		return false;
+	}
 
 	if (output_thread_init(ctx)) {
 		decode_thread_init(ctx);
@@ -791,6 +804,7 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 		return true;
 	} else {
 		stream_close(ctx);
+		buf_pool_destroy(&ctx->buf_pool);
 		return false;
 	}
 }
@@ -798,7 +812,6 @@ bool sq_run_device(sq_dev_handle_t handle, sq_dev_param_t *param)
 /*--------------------------------------------------------------------------*/
 void *sq_get_ptr(sq_dev_handle_t handle)
 {
-	if (!handle) return NULL;
-	else return thread_ctx + handle - 1;
+	return table_get(&thread_ctx, handle - 1);
 }
 
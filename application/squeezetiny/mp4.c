@@ -0,0 +1,435 @@
+/*
+ *  Squeezelite - lightweight headless squeezebox emulator
+ *
+ *  (c) Adrian Smith 2012-2015, triode1@btinternet.com
+ *  (c) Philippe, philippe_44@outlook.com for raop/multi-instance modifications
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// streaming mp4 demuxer shared by faad, alac and m4a_thru
+
+#include "squeezelite.h"
+
+extern log_level 	decode_loglevel;
+static log_level 	*loglevel = &decode_loglevel;
+
+#define MP4_MOOV	MP4_FOURCC('m','o','o','v')
+#define MP4_TRAK	MP4_FOURCC('t','r','a','k')
+#define MP4_MDIA	MP4_FOURCC('m','d','i','a')
+#define MP4_MINF	MP4_FOURCC('m','i','n','f')
+#define MP4_STBL	MP4_FOURCC('s','t','b','l')
+#define MP4_UDTA	MP4_FOURCC('u','d','t','a')
+#define MP4_ILST	MP4_FOURCC('i','l','s','t')
+#define MP4_META	MP4_FOURCC('m','e','t','a')
+#define MP4_STSD	MP4_FOURCC('s','t','s','d')
+#define MP4_ESDS	MP4_FOURCC('e','s','d','s')
+#define MP4_STTS	MP4_FOURCC('s','t','t','s')
+#define MP4_STSC	MP4_FOURCC('s','t','s','c')
+#define MP4_STSZ	MP4_FOURCC('s','t','s','z')
+#define MP4_STCO	MP4_FOURCC('s','t','c','o')
+#define MP4_MDAT	MP4_FOURCC('m','d','a','t')
+#define MP4_ITUN	MP4_FOURCC('-','-','-','-')
+
+/*---------------------------------------------------------------------------*/
+// adapted from faad2/common/mp4ff
+static u32_t desc_length(u8_t **buf) {
+	u8_t b;
+	u8_t num_bytes = 0;
+	u32_t length = 0;
+
+	do {
+		b = **buf;
+		*buf += 1;
+		num_bytes++;
+		length = (length << 7) | (b & 0x7f);
+	} while ((b & 0x80) && num_bytes < 4);
+
+	return length;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool set_config(struct mp4 *mp4, u8_t *ptr, u32_t len) {
+	if (mp4->config) free(mp4->config);
+	if ((mp4->config = malloc(len)) == NULL) return false;
+	memcpy(mp4->config, ptr, len);
+	mp4->config_len = len;
+	mp4->play = mp4->trak;
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// decoder specific info is the AudioSpecificConfig in esds
+static bool parse_esds(struct mp4 *mp4, u8_t *ptr) {
+	ptr += 12;
+	if (*ptr++ == 0x03) {
+		desc_length(&ptr);
+		ptr += 4;
+	} else {
+		ptr += 3;
+	}
+	desc_length(&ptr);
+	ptr += 13;
+	if (*ptr++ != 0x05) return false;
+	return set_config(mp4, ptr, desc_length(&ptr));
+}
+
+/*---------------------------------------------------------------------------*/
+// a table of count entries after header must fit in the box
+static bool table_fits(u32_t len, u32_t header, u32_t count, u32_t entry_size) {
+	return len >= header && count <= (len - header) / entry_size;
+}
+
+/*---------------------------------------------------------------------------*/
+// sizes are 16 bits when possible, 32 bits otherwise
+static bool parse_stsz(struct mp4 *mp4, u8_t *ptr, u32_t len) {
+	u32_t i, largest = 0;
+
+	if (len < 20) return false;
+
+	mp4->fixed_size = unpackN((u32_t*) (ptr + 12));
+	if (mp4->fixed_size) return true;
+
+	if (!table_fits(len, 20, unpackN((u32_t*) (ptr + 16)), 4)) return false;
+	mp4->sample_count = unpackN((u32_t*) (ptr + 16));
+	ptr += 20;
+
+	for (i = 0; i < mp4->sample_count; i++) largest = max(largest, unpackN((u32_t*) (ptr + i * 4)));
+	mp4->wide = largest > 0xffff;
+
+	mp4->sizes = malloc(mp4->sample_count * (mp4->wide ? 4 : 2));
+	if (!mp4->sizes) return false;
+
+	for (i = 0; i < mp4->sample_count; i++, ptr += 4) {
+		if (mp4->wide) ((u32_t*) mp4->sizes)[i] = unpackN((u32_t*) ptr);
+		else ((u16_t*) mp4->sizes)[i] = unpackN((u32_t*) ptr);
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// stsc is already run-length, keep (first chunk, samples per chunk) pairs
+static bool parse_stsc(struct mp4 *mp4, u8_t *ptr, u32_t len) {
+	u32_t i;
+
+	if (len < 16) return false;
+
+	if (!table_fits(len, 16, unpackN((u32_t*) (ptr + 12)), 12)) return false;
+	mp4->stsc_entries = unpackN((u32_t*) (ptr + 12));
+	mp4->stsc = malloc(mp4->stsc_entries * 2 * sizeof(u32_t));
+	if (!mp4->stsc) return false;
+
+	for (i = 0, ptr += 16; i < mp4->stsc_entries; i++, ptr += 12) {
+		mp4->stsc[i * 2] = unpackN((u32_t*) ptr);
+		mp4->stsc[i * 2 + 1] = unpackN((u32_t*) (ptr + 4));
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// offsets are 16 bits deltas to previous chunk when possible, 32 bits otherwise
+static bool parse_stco(struct mp4 *mp4, u8_t *ptr, u32_t len) {
+	u32_t i;
+
+	if (len < 16) return false;
+
+	if (!table_fits(len, 16, unpackN((u32_t*) (ptr + 12)), 4)) return false;
+	mp4->chunks = unpackN((u32_t*) (ptr + 12));
+	ptr += 16;
+
+	for (i = 1; i < mp4->chunks && !mp4->wide_offsets; i++) {
+		u32_t prev = unpackN((u32_t*) (ptr + (i - 1) * 4)), offset = unpackN((u32_t*) (ptr + i * 4));
+		mp4->wide_offsets = offset < prev || offset - prev > 0xffff;
+	}
+
+	mp4->offsets = malloc(mp4->chunks * (mp4->wide_offsets ? 4 : 2));
+	if (!mp4->offsets) return false;
+
+	// first chunk is always known in full
+	if (mp4->chunks) mp4->offset = unpackN((u32_t*) ptr);
+
+	for (i = 0; i < mp4->chunks; i++, ptr += 4) {
+		if (mp4->wide_offsets) ((u32_t*) mp4->offsets)[i] = unpackN((u32_t*) ptr);
+		else ((u16_t*) mp4->offsets)[i] = i ? unpackN((u32_t*) ptr) - unpackN((u32_t*) (ptr - 4)) : 0;
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static bool parse_stts(struct mp4 *mp4, u8_t *ptr, u32_t len, struct thread_ctx_s *ctx) {
+	u32_t entries;
+
+	if (len < 16) return false;
+
+	entries = unpackN((u32_t*) (ptr + 12));
+	if (!table_fits(len, 16, entries, 8)) return false;
+
+	for (ptr += 16; entries--; ptr += 8) {
+		mp4->stts_samples += (u64_t) unpackN((u32_t*) ptr) * unpackN((u32_t*) (ptr + 4));
+	}
+
+	LOG_DEBUG("[%p]: total number of samples contained in stts: " FMT_u64, ctx, mp4->stts_samples);
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// key-value atoms within ilst ---- entries have encoder padding within iTunSMPB entry for gapless
+static void parse_itunes(struct mp4 *mp4, u8_t *ptr, u32_t len, struct thread_ctx_s *ctx) {
+	u32_t remain, size;
+
+	if (len < 8) return;
+
+	remain = len - 8;
+	ptr += 8;
+
+	if (remain >= 8 && !memcmp(ptr + 4, "mean", 4) && (size = unpackN((u32_t *)ptr)) < remain) {
+		ptr += size; remain -= size;
+	}
+	if (remain >= 20 && !memcmp(ptr + 4, "name", 4) && (size = unpackN((u32_t *)ptr)) < remain && !memcmp(ptr + 12, "iTunSMPB", 8)) {
+		ptr += size; remain -= size;
+	}
+	if (remain > 16 + 48 && !memcmp(ptr + 4, "data", 4)) {
+		// data is stored as hex strings: 0 start end samples
+		u32_t b, c; u64_t d;
+		if (sscanf((const char *)(ptr + 16), "%x %x %x " FMT_x64, &b, &b, &c, &d) == 4) {
+			LOG_DEBUG("[%p]: iTunSMPB start: %u end: %u samples: " FMT_u64, ctx, b, c, d);
+			if (mp4->stts_samples && mp4->stts_samples < b + c + d) {
+				LOG_DEBUG("[%p]: reducing samples as stts count is less", ctx);
+				d = mp4->stts_samples - (b + c);
+			}
+			mp4->skip = b;
+			mp4->samples = d;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// samples in current chunk, runs are sorted by (1-based) first chunk
+static u32_t chunk_samples(struct mp4 *mp4) {
+	while (mp4->stsc_index + 1 < mp4->stsc_entries && mp4->stsc[(mp4->stsc_index + 1) * 2] <= mp4->chunk + 1) {
+		mp4->stsc_index++;
+	}
+	return mp4->stsc_entries ? mp4->stsc[mp4->stsc_index * 2 + 1] : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// move forward, what is not yet in streambuf will be consumed later
+static void _mp4_skip(struct mp4 *mp4, u32_t bytes, struct thread_ctx_s *ctx) {
+	u32_t now = min(bytes, _buf_used(ctx->streambuf));
+
+	_buf_inc_readp(ctx->streambuf, now);
+	mp4->pos += now;
+	mp4->consume = bytes - now;
+}
+
+/*---------------------------------------------------------------------------*/
+// mp4 must be zeroed before first use, entry is the wanted sample entry
+void mp4_init(struct mp4 *mp4, u32_t entry) {
+	mp4_close(mp4);
+	memset(mp4, 0, sizeof(struct mp4));
+	mp4->entry = entry;
+}
+
+/*---------------------------------------------------------------------------*/
+void mp4_close(struct mp4 *mp4) {
+	if (mp4->config) free(mp4->config);
+	if (mp4->sizes) free(mp4->sizes);
+	if (mp4->offsets) free(mp4->offsets);
+	if (mp4->stsc) free(mp4->stsc);
+	mp4->config = mp4->sizes = NULL;
+	mp4->offsets = mp4->stsc = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+// parse boxes up to mdat: 1 when found, 0 to come back with more data, -1 on error
+int _mp4_header(struct mp4 *mp4, struct thread_ctx_s *ctx) {
+	size_t bytes = _buf_contiguous(ctx->streambuf);
+
+	// unless streambuf is mirrored, assume that header will not wrap around
+	while (bytes >= 8) {
+		u8_t *ptr = ctx->streambuf->readp;
+		u32_t len = unpackN((u32_t*) ptr), type = unpackN((u32_t*) (ptr + 4));
+		bool full = bytes >= len, playing = mp4->play && mp4->play == mp4->trak;
+		u32_t consume = len;
+
+		// no 64 bits or up to end of file sizes, these would never be consumed
+		if (len < 8 && type != MP4_MDAT) {
+			LOG_WARN("[%p]: type: %.4s unsupported len: %u", ctx, ptr + 4, len);
+			return -1;
+		}
+
+		switch (type) {
+		case MP4_MOOV:
+			mp4->trak = mp4->play = 0;
+			consume = 8;
+			break;
+		case MP4_TRAK:
+			mp4->trak++;
+			consume = 8;
+			break;
+		case MP4_MDIA: case MP4_MINF: case MP4_STBL: case MP4_UDTA: case MP4_ILST:
+			consume = 8;
+			break;
+		// these mix data in the enclosing box which we want to read into
+		case MP4_STSD:
+			consume = 16;
+			break;
+		case MP4_META:
+			consume = 12;
+			break;
+		case MP4_FOURCC('m','p','4','a'):
+			consume = 36;
+			break;
+		// these need to be fully in the buffer to be parsed
+		case MP4_ESDS:
+			if (!full) return 0;
+			if (mp4->entry == MP4_FOURCC('m','p','4','a') && !mp4->play && !parse_esds(mp4, ptr)) {
+				LOG_WARN("[%p]: error parsing esds", ctx);
+				return -1;
+			}
+			break;
+		case MP4_FOURCC('a','l','a','c'):
+			if (!full) return 0;
+			if (mp4->entry == type && !mp4->play && (len < 36 || !set_config(mp4, ptr + 36, len - 36))) return -1;
+			break;
+		case MP4_STTS:
+			if (!full) return 0;
+			if (playing && !parse_stts(mp4, ptr, len, ctx)) {
+				LOG_WARN("[%p]: error parsing stts", ctx);
+				return -1;
+			}
+			break;
+		case MP4_STSC:
+			if (!full) return 0;
+			if (playing && !mp4->stsc && !parse_stsc(mp4, ptr, len)) {
+				LOG_WARN("[%p]: error parsing stsc", ctx);
+				return -1;
+			}
+			break;
+		case MP4_STSZ:
+			if (!full) return 0;
+			if (playing && !mp4->sizes && !mp4->fixed_size && !parse_stsz(mp4, ptr, len)) {
+				LOG_WARN("[%p]: error parsing stsz", ctx);
+				return -1;
+			}
+			break;
+		case MP4_STCO:
+			if (!full) return 0;
+			if (playing && !mp4->offsets && !parse_stco(mp4, ptr, len)) {
+				LOG_WARN("[%p]: error parsing stco", ctx);
+				return -1;
+			}
+			break;
+		case MP4_ITUN:
+			if (!full) return 0;
+			parse_itunes(mp4, ptr, len, ctx);
+			break;
+		// found media data, advance to start of first chunk and return
+		case MP4_MDAT:
+			_buf_inc_readp(ctx->streambuf, 8);
+			mp4->pos += 8;
+
+			if (!mp4->play) {
+				// some file have mdat before moov, but we can't seek
+				LOG_ERROR("[%p]: type: mdat len: %u, no playable track found", ctx, len);
+				return -1;
+			}
+
+			LOG_DEBUG("[%p]: type: mdat len: %u pos: %u", ctx, len, mp4->pos);
+
+			if (mp4->offsets && mp4->chunks && mp4->offset > mp4->pos) {
+				LOG_DEBUG("[%p]: skipping: %u", ctx, mp4->offset - mp4->pos);
+				_mp4_skip(mp4, mp4->offset - mp4->pos, ctx);
+			}
+
+			// no chunk jumps if either table is missing
+			mp4->sample = mp4->chunk = mp4->stsc_index = 0;
+			mp4->chunk_left = mp4->offsets ? chunk_samples(mp4) : 0;
+			return 1;
+		}
+
+		// consume rest of box if it has been parsed (all in the buffer) or is not one we want to parse
+		if (bytes >= consume) {
+			LOG_DEBUG("[%p]: type: %.4s len: %u consume: %u", ctx, ptr + 4, len, consume);
+			_buf_inc_readp(ctx->streambuf, consume);
+			mp4->pos += consume;
+			bytes -= consume;
+		} else {
+			LOG_DEBUG("[%p]: type: %.4s len: %u consume: %u - partial consume: %u", ctx, ptr + 4, len, consume, bytes);
+			_mp4_skip(mp4, consume, ctx);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// skip what could not be done at previous call, true if there was something
+bool _mp4_consume(struct mp4 *mp4, struct thread_ctx_s *ctx) {
+	u32_t consume;
+
+	if (!mp4->consume) return false;
+
+	consume = min(mp4->consume, _buf_used(ctx->streambuf));
+	LOG_DEBUG("[%p]: consume: %u of %u", ctx, consume, mp4->consume);
+	_buf_inc_readp(ctx->streambuf, consume);
+	mp4->pos += consume;
+	mp4->consume -= consume;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// size of the current sample, 0 if unknown or none left
+u32_t mp4_sample_size(struct mp4 *mp4) {
+	if (mp4->fixed_size) return mp4->fixed_size;
+	if (mp4->sample >= mp4->sample_count) return 0;
+	return mp4->wide ? ((u32_t*) mp4->sizes)[mp4->sample] : ((u16_t*) mp4->sizes)[mp4->sample];
+}
+
+/*---------------------------------------------------------------------------*/
+// move past current sample, or to the next chunk when it was the last of its chunk
+bool _mp4_next(struct mp4 *mp4, u32_t consumed, struct thread_ctx_s *ctx) {
+	u32_t skip = consumed;
+
+	mp4->sample++;
+
+	if (mp4->chunk_left && !--mp4->chunk_left && ++mp4->chunk < mp4->chunks) {
+		u32_t offset = mp4->wide_offsets ? ((u32_t*) mp4->offsets)[mp4->chunk] :
+											mp4->offset + ((u16_t*) mp4->offsets)[mp4->chunk];
+
+		mp4->offset = offset;
+
+		if (offset <= mp4->pos) {
+			LOG_ERROR("[%p]: error: need to skip backwards!", ctx);
+			return false;
+		}
+
+		skip = offset - mp4->pos;
+		if (skip != consumed) {
+			LOG_DEBUG("[%p]: skipping to next chunk pos: %u consumed: %u != skip: %u", ctx, mp4->pos, consumed, skip);
+		}
+
+		mp4->chunk_left = chunk_samples(mp4);
+	}
+
+	_mp4_skip(mp4, skip, ctx);
+
+	return true;
+}
@@ -38,6 +38,7 @@ static void 	apply_cross(struct buffer *outputbuf, s32_t *cptr, u32_t fade,
 							u32_t gain_in, u32_t gain_out, u8_t shift, size_t frames);
 static void 	scale_and_pack(void *dst, u32_t *src, size_t frames, u8_t channels,
 							   u8_t sample_size, int endian);
+static size_t 	_output_pad(struct buffer *buf, struct thread_ctx_s *ctx);
 #if CODECS
 static void 	to_mono(s32_t *iptr,  size_t frames);
 static int 		shine_make_config_valid(int freq, int *bitr);
@@ -151,10 +152,11 @@ static void little16(void *dst, u16_t src);
 static void little32(void *dst, u32_t src);
 static void big16(void *dst, u16_t src);
 static void big32(void *dst, u32_t src);
+static size_t	render_header(u8_t *dst, char format, u32_t rate, u8_t size, u8_t channels, size_t length);
 
 
 /*---------------------------------------------------------------------------*/
-bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
+bool _output_fill(struct buffer *buf, struct store_s *store, struct thread_ctx_s *ctx) {
 	size_t bytes = _buf_space(buf);
 	u8_t *writep = buf->writep;
 	struct outputstate *p = &ctx->output;
@@ -175,31 +177,28 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	*/
 	if (bytes < HTTP_STUB_DEPTH) return true;
 
-	// write header pending data if any and exit
-	if (p->header.buffer) {
-		bytes = min(p->header.count, _buf_cont_write(buf));
-		memcpy(buf->writep, p->header.buffer + p->header.size - p->header.count, bytes);
-		_buf_inc_writep(buf, bytes);
-		if (store) fwrite(p->header.buffer + p->header.size - p->header.count, bytes, 1, store);
-		p->header.count -= bytes;
-
-		if (!p->header.count) {
-			LOG_INFO("[%p] PCM header sent (%u bytes)", ctx, p->header.size);
-			NFREE(p->header.buffer);
-		}
-
-		return true;
+	// write header at once and proceed so that it goes out with the first audio
+	if (p->header.count) {
+		_buf_write(buf, p->header.buffer + p->header.size - p->header.count, p->header.count);
+		if (store) store_write(store, p->header.buffer + p->header.size - p->header.count, p->header.count);
+		writep = buf->writep;
+		p->header.count = 0;
+		LOG_INFO("[%p] PCM header sent (%u bytes)", ctx, p->header.size);
 	}
 
-	bytes = min(bytes, _buf_cont_read(ctx->outputbuf));
+	bytes = min(bytes, _buf_cont_read(p->shared ? ctx->streambuf : ctx->outputbuf));
 
-	// now proceeding audio data
-	if (p->encode.mode == ENCODE_THRU) {
-		//	simple encoded audio, nothing to process, just forward outputbuf
+	// now proceeding audio data, or silence when exact length was not reached
+	if (!bytes && p->exact && p->exact_left && ctx->decode.state > DECODE_RUNNING) {
+		bytes = _output_pad(buf, ctx);
+	} else if (p->encode.mode == ENCODE_THRU) {
+		//	simple encoded audio, nothing to process, just forward outputbuf (or streambuf if shared)
+		struct buffer *src = p->shared ? ctx->streambuf : ctx->outputbuf;
 		bytes = min(bytes, _buf_cont_write(buf));
-		memcpy(buf->writep, ctx->outputbuf->readp, bytes);
+		memcpy(buf->writep, src->readp, bytes);
 		_buf_inc_writep(buf, bytes);
-		_buf_inc_readp(ctx->outputbuf, bytes);
+		_buf_inc_readp(src, bytes);
+		if (bytes) wake_decode(ctx);
 	} else {
 		// uncompressed audio to be processed
 		size_t in, out, frames = 0, process;
@@ -208,10 +207,17 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 		// outputbuf is processed by BYTES_PER_FRAMES multiples => aligns fine
 		in = min(_buf_used(ctx->outputbuf), _buf_cont_read(ctx->outputbuf));
 
-		// no bytes may mean end of audio data - need at least one frame
+		// no bytes may mean end of audio data - need at least one frame
 		if (!in) return false;
 		else if (in < BYTES_PER_FRAME) return true;
 
+		// all that was announced has been sent, the rest is dropped
+		if (p->exact && !p->exact_left) {
+			_buf_inc_readp(ctx->outputbuf, in - in % BYTES_PER_FRAME);
+			wake_decode(ctx);
+			return true;
+		}
+
 		if (p->encode.mode == ENCODE_PCM) {
 			u8_t *optr, obuf[BYTES_PER_FRAME*2];
 
@@ -232,6 +238,7 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 			in = min(in, _buf_cont_read(ctx->outputbuf));
 			frames = min(in / BYTES_PER_FRAME, out / bytes_per_frame);
 			frames = min(frames, p->encode.sample_rate / MAX_FRAMES_SEC);
+			if (p->exact) frames = min(frames, p->exact_left / bytes_per_frame);
 
 			// L24_PCM and one frame or previous odd frames to process
 			if (p->encode.buffer && p->encode.count == 1) frames = 1;
@@ -266,9 +273,11 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 			} else scale_and_pack(optr, (u32_t*) ctx->outputbuf->readp, frames,
 								  p->encode.channels, p->encode.sample_size, p->out_endian);
 
-			// take the data from temporary buffer if needed
+			// take the data from temporary buffer if needed
 			if (optr == obuf) _buf_write(buf, optr, bytes_per_frame * process);
 			else _buf_inc_writep(buf, process * bytes_per_frame);
+
+			if (p->exact) p->exact_left -= min(p->exact_left, process * bytes_per_frame);
 #if CODECS
 		} else if (p->encode.mode == ENCODE_FLAC) {
 			if (!p->encode.codec) return false;
@@ -330,6 +339,7 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 		}
 
 		_buf_inc_readp(ctx->outputbuf, frames * BYTES_PER_FRAME);
+		if (frames) wake_decode(ctx);
 
 		LOG_SDEBUG("[%p]: processed %u frames", ctx, frames);
 	}
@@ -337,16 +347,47 @@ bool _output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx) {
 	if (store) {
 		size_t out, bytes = (buf->writep - writep) % buf->size;
 		out = min(bytes, buf->wrap - writep);
-		fwrite(writep, out, 1, store);
-		fwrite(buf->buf, bytes - out, 1, store);
+		store_write(store, writep, out);
+		store_write(store, buf->buf, bytes - out);
 	}
 
 	return (bytes != 0);
 }
 
+/*---------------------------------------------------------------------------*/
+// render wav/aif header in place, no allocation per stream
+static size_t render_header(u8_t *dst, char format, u32_t rate, u8_t size, u8_t channels, size_t length) {
+	if (format == 'w') {
+		struct wave_header_s *h = (struct wave_header_s*) dst;
+
+		memcpy(h, &wave_header, sizeof(struct wave_header_s));
+		little16(&h->channels, channels);
+		little16(&h->bits_per_sample, size);
+		little32(&h->sample_rate, rate);
+		little32(&h->byte_rate, rate * channels * (size / 8));
+		little16(&h->block_align, channels * (size / 8));
+		little32(&h->subchunk2_size, length);
+		little32(&h->chunk_size, 36 + length);
+		return sizeof(struct wave_header_s);
+	} else {
+		struct aiff_header_s *h = (struct aiff_header_s*) dst;
+
+		memcpy(h, &aiff_header, sizeof(struct aiff_header_s));
+		big16(h->channels, channels);
+		big16(h->sample_size, size);
+		big16(h->sample_rate_num, rate);
+		big32(&h->data_size, length + 8);
+		big32(&h->chunk_size, (length+8+8) + (18+8) + 4);
+		big32(&h->frames, length / (channels * (size / 8)));
+		return 54; // can't count on structure due to alignment
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 void _output_new_stream(struct buffer *obuf, struct thread_ctx_s *ctx) {
 	struct outputstate *out = &ctx->output;
+	// HTTP mode set at stream start, might differ from config
+	int mode = out->length;
 
 	if (!out->encode.sample_rate) out->encode.sample_rate = out->sample_rate;
 	if (!out->encode.channels) out->encode.channels = out->channels;
@@ -355,6 +396,11 @@ void _output_new_stream(struct buffer *obuf, struct thread_ctx_s *ctx) {
 		else out->encode.sample_size = out->sample_size;
 	}
 
+	// exact length needs PCM and a known duration, otherwise use chunked encoding
+	out->exact = false;
+	out->header.size = out->header.count = 0;
+	if (mode == HTTP_EXACT_LENGTH) out->length = HTTP_CHUNKED;
+
 	if (out->encode.mode == ENCODE_PCM) {
 		size_t length;
 
@@ -364,48 +410,26 @@ void _output_new_stream(struct buffer *obuf, struct thread_ctx_s *ctx) {
 		should be consistent
 		*/
 		if (!out->duration || out->encode.flow) {
-			if (ctx->config.stream_length < 0) length = MAX_FILE_SIZE;
-			else length = ctx->config.stream_length;
+			if (mode < 0) length = MAX_FILE_SIZE;
+			else length = mode;
 			length = (length / ((u64_t) out->encode.sample_rate * out->encode.channels * out->encode.sample_size /8)) *
 					 (u64_t) out->encode.sample_rate * out->encode.channels * out->encode.sample_size / 8;
 		} else length = (((u64_t) out->duration * out->encode.sample_rate) / 1000) * out->encode.channels * (out->encode.sample_size / 8);
 
+		if (mode == HTTP_EXACT_LENGTH && out->duration && !out->encode.flow) {
+			out->exact = true;
+			out->exact_left = length;
+		}
+
 		switch (out->format) {
-		case 'w': {
-			struct wave_header_s *h = malloc(sizeof(struct wave_header_s));
-
-			memcpy(h, &wave_header, sizeof(struct wave_header_s));
-			little16(&h->channels, out->encode.channels);
-			little16(&h->bits_per_sample, out->encode.sample_size);
-			little32(&h->sample_rate, out->encode.sample_rate);
-			little32(&h->byte_rate, out->encode.sample_rate * out->encode.channels * (out->encode.sample_size / 8));
-			little16(&h->block_align, out->encode.channels * (out->encode.sample_size / 8));
-			little32(&h->subchunk2_size, length);
-			little32(&h->chunk_size, 36 + length);
-			length += 36 + 8;
-			out->header.buffer = (u8_t*) h;
-			out->header.size = out->header.count = sizeof(struct wave_header_s);
-		   }
-		   break;
-	   case 'i': {
-			struct aiff_header_s *h = malloc(sizeof(struct aiff_header_s));
-
-			memcpy(h, &aiff_header, sizeof(struct aiff_header_s));
-			big16(h->channels, out->encode.channels);
-			big16(h->sample_size, out->encode.sample_size);
-			big16(h->sample_rate_num, out->encode.sample_rate);
-			big32(&h->data_size, length + 8);
-			big32(&h->chunk_size, (length+8+8) + (18+8) + 4);
-			big32(&h->frames, length / (out->encode.channels * (out->encode.sample_size / 8)));
-			length += (8+8) + (18+8) + 4 + 8;
-			out->header.buffer = (u8_t*) h;
-			out->header.size = out->header.count = 54; // can't count on structure due to alignment
-			}
+		case 'w':
+		case 'i':
+			out->header.size = out->header.count = render_header(out->header.buffer, out->format, out->encode.sample_rate,
+																 out->encode.sample_size, out->encode.channels, length);
+			length += out->header.size;
 			break;
 		case 'p':
 		default:
-			out->header.buffer = NULL;
-			out->header.size = out->header.count = 0;
 			if (out->encode.sample_size == 24 && ctx->config.L24_format == L24_PACKED_LPCM) {
 				// need room for 2 frames with L+R
 				out->encode.buffer = malloc(2 * BYTES_PER_FRAME);
@@ -419,11 +443,11 @@ void _output_new_stream(struct buffer *obuf, struct thread_ctx_s *ctx) {
 			break;
 		}
 
-		if (ctx->config.stream_length > 0 || ctx->config.stream_length == HTTP_PCM_LENGTH) ctx->output.length = length;
+		if (mode > 0 || mode == HTTP_PCM_LENGTH || out->exact) ctx->output.length = length;
 
 		LOG_INFO("[%p]: PCM encoding r:%u s:%u f:%c", ctx, out->encode.sample_rate,
 											out->encode.sample_size, out->format);
-		LOG_INFO("[%p]: HTTP %d, estimated len %zu", ctx, ctx->config.stream_length, length);
+		LOG_INFO("[%p]: HTTP %d, estimated len %zu", ctx, mode, length);
 #if CODECS
 	} else if (out->encode.mode == ENCODE_FLAC) {
 		FLAC__StreamEncoder *codec;
@@ -479,6 +503,25 @@ void _output_new_stream(struct buffer *obuf, struct thread_ctx_s *ctx) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// exact length mode, complete with silence when audio was shorter than announced
+static size_t _output_pad(struct buffer *buf, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	size_t pad = min(out->exact_left, _buf_space(buf)), done = pad;
+
+	LOG_DEBUG("[%p]: padding %zu bytes to exact length (%zu left)", ctx, pad, out->exact_left);
+	out->exact_left -= pad;
+
+	while (pad) {
+		size_t bytes = min(pad, _buf_cont_write(buf));
+		memset(buf->writep, 0, bytes);
+		_buf_inc_writep(buf, bytes);
+		pad -= bytes;
+	}
+
+	return done;
+}
+
 /*---------------------------------------------------------------------------*/
 void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 	struct outputstate *out = &ctx->output;
@@ -515,6 +558,10 @@ void _output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx) {
 	}
 #endif
 
+	// padding to exact length has been done by _output_fill, unless stream is aborted
+	if (buf && out->exact && out->exact_left) LOG_WARN("[%p]: missing %zu bytes to exact length", ctx, out->exact_left);
+	out->exact = false;
+
 	// free any buffer
 	NFREE(out->encode.buffer);
 	out->encode.count = 0;
@@ -545,7 +592,8 @@ void output_flush(struct thread_ctx_s *ctx) {
 	ctx->output.track_started = false;
 	ctx->output.track_start = NULL;
 	ctx->output.encode.flow = false;
-	NFREE(ctx->output.header.buffer);
+	ctx->output.shared = false;
+	ctx->output.header.count = 0;
 	output_free_icy(ctx);
 	_output_end_stream(NULL, ctx);
 	ctx->render.index = -1;
@@ -564,15 +612,24 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 	if (ctx->config.outputbuf_size <= OUTPUTBUF_IDLE_SIZE) ctx->config.outputbuf_size = OUTPUTBUF_SIZE;
 	else ctx->config.outputbuf_size = (ctx->config.outputbuf_size * BYTES_PER_FRAME) / BYTES_PER_FRAME;
 	ctx->outputbuf = &ctx->__o_buf;
-	buf_init(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
+
+	// full size is only allocated with first track, then kept until idle release
+	buf_init_pool(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE, &ctx->buf_pool);
+	if (!ctx->outputbuf->buf) {
+		LOG_ERROR("[%p] unable to malloc buffer", ctx);
+		buf_destroy(ctx->outputbuf);
+		return false;
+	}
 
 	// all this is NULL at init, normally ...
 	ctx->output.track_started = false;
 	ctx->output.track_start = NULL;
 	ctx->output.encode.flow = false;
+	ctx->output.shared = false;
 	ctx->output.encode.codec = NULL;
 	ctx->output.fade_writep = NULL;
 	ctx->output.icy.artist = ctx->output.icy.title = ctx->output.icy.artwork = NULL;
+	ctx->output.icy.buffer = NULL;
 
 	ctx->output_thread[0].running = ctx->output_thread[1].running = false;
 	ctx->output_thread[0].http = ctx->output_thread[1].http = -1;
@@ -584,6 +641,7 @@ bool output_thread_init(struct thread_ctx_s *ctx) {
 /*---------------------------------------------------------------------------*/
 void output_close(struct thread_ctx_s *ctx) {
 	LOG_INFO("[%p] close media renderer", ctx);
+	NFREE(ctx->output.icy.buffer);
 	buf_destroy(ctx->outputbuf);
 }
 
@@ -619,7 +677,7 @@ bool output_init(void) {
 /*---------------------------------------------------------------------------*/
 void output_end(void) {
 #if !LINKALL && CODECS
-	if (handle) dlclose(handle);
+	if (handle) dlclose(handle);
 #endif
 }
 
@@ -990,7 +1048,11 @@ size_t gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx) {
 				gain = ((u64_t) cur_f << 16) / dur_f;
 			} else if (out->fade_dir == FADE_CROSS) {
 				// cross fade requires special treatment done below
-				if (_buf_used(ctx->outputbuf) / BYTES_PER_FRAME > dur_f + frames) {
+				frames_t used_f = _buf_used(ctx->outputbuf) / BYTES_PER_FRAME;
+
+				if (used_f > dur_f) {
+					// mix whatever incoming track allows, don't stall while both have data
+					frames = min(frames, used_f - dur_f);
 					gain  = ((u64_t) cur_f << 16) / dur_f;
 					cptr = (s32_t *)(out->fade_end + cur_f * BYTES_PER_FRAME);
 				} else {
@@ -1003,8 +1065,8 @@ size_t gain_and_fade(size_t frames, u8_t shift, struct thread_ctx_s *ctx) {
 					and that cross-fade does not happen for last track, then the
 					risk of being stuck is low & preferred.
 					*/
+					LOG_INFO("[%p]: need more frames for cross-fade %u", ctx, dur_f + frames - used_f);
 					frames = 0;
-					LOG_INFO("[%p]: need more frames for cross-fade %u", ctx, dur_f + frames - _buf_used(ctx->outputbuf) / BYTES_PER_FRAME);
 				}
 			}
 		} else if (out->fade_writep) {
@@ -1066,23 +1128,29 @@ static void apply_gain(s32_t *iptr, u32_t fade, u32_t gain, u8_t shift, size_t f
 	}
 }
 
-/*---------------------------------------------------------------------------*/
-void apply_cross(struct buffer *outputbuf, s32_t *cptr, u32_t fade, u32_t gain_in, u32_t gain_out, u8_t shift, size_t frames) {
-	s32_t *iptr = (s32_t *) outputbuf->readp;
-	frames_t count = frames * 2;
-	s64_t sample;
+/*---------------------------------------------------------------------------*/
+// outgoing track (iptr) is contiguous, incoming one (cptr) can wrap once
+static void apply_cross(struct buffer *outputbuf, s32_t *cptr, u32_t fade, u32_t gain_in, u32_t gain_out, u8_t shift, size_t frames) {
+	s32_t *iptr = (s32_t *) outputbuf->readp, *wrap = (s32_t *) outputbuf->wrap;
 
 	if (!gain_in) gain_in = 65536L;
-	if (!gain_out) gain_out = 65536L;
-
-	while (count--) {
-		if (cptr > (s32_t *) outputbuf->wrap) cptr -= outputbuf->size / BYTES_PER_FRAME * 2;
-		sample = ((*iptr * (s64_t) gain_in) >> 16) * (65536L - fade) + ((*cptr++ * (s64_t) gain_out) >> 16) * fade;
-		if (sample > MAX_VAL32) sample = MAX_VAL32;
-		else if (sample < -MAX_VAL32) sample = -MAX_VAL32;
-		*iptr++ = sample >> (16 + shift);
+	if (!gain_out) gain_out = 65536L;
+
+	// fold fade into gains so that mixing is a 2 taps multiply-add
+	gain_in = ((u64_t) gain_in * (65536L - fade)) >> 16;
+	gain_out = ((u64_t) gain_out * fade) >> 16;
+
+	if (cptr >= wrap) cptr -= outputbuf->size / sizeof(s32_t);
+
+	while (frames) {
+		size_t block = min(frames, (size_t) (wrap - cptr) / 2);
+
+		conv_mix(iptr, cptr, block * 2, gain_in, gain_out, shift);
+		iptr += block * 2;
+		frames -= block;
+		cptr = (s32_t *) outputbuf->buf;
 	}
-}
+}
 
 /*---------------------------------------------------------------------------*/
 #if CODECS
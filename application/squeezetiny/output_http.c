@@ -19,18 +19,32 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include "squeezelite.h"
 #include "tinyutils.h"
 
+#include <sys/uio.h>
+#if LINUX
+#include <sys/resource.h>
+#endif
+
+#if SPLICE
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#endif
+
 extern log_level	output_loglevel;
 static log_level 	*loglevel = &output_loglevel;
 
+#define LOCK_S   mutex_lock(ctx->streambuf->mutex)
+#define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
 #define LOCK_O 	 mutex_lock(ctx->outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
 #define LOCK_D   mutex_lock(ctx->decode.mutex)
 #define UNLOCK_D mutex_unlock(ctx->decode.mutex)
 
-#define MAX_CHUNK_SIZE	(256*1024)
+#define MAX_CHUNK_SIZE	(1024*1024)
 #define MAX_BLOCK		(32*1024)
 #define TAIL_SIZE		(2048*1024)
 #define HEAD_SIZE		65536
@@ -38,23 +52,53 @@ static log_level 	*loglevel = &output_loglevel;
 #define TIMEOUT			50
 #define SLEEP			50
 #define DRAIN_MAX		(5000 / TIMEOUT)
+#define STORE_SLOTS		8
+#define STORE_SLOT_SIZE	(256*1024)
 
 struct thread_param_s {
 	struct thread_ctx_s *ctx;
 	struct output_thread_s *thread;
 };
 
+struct chunk_s {
+	char head[16];
+	size_t hlen, size, sent;	// size is 0 when no chunk is pending
+};
+
+// capture file written by its own thread so that disk never stalls output
+struct store_s {
+	int fd;
+	bool running;
+	mutex_type mutex;
+	cond_type ready;
+	thread_type thread;
+	u8_t *slot[STORE_SLOTS];
+	unsigned head, tail;		// slot being filled, oldest slot queued for writing
+	size_t fill, dropped, written;
+};
+
 static void 	output_http_thread(struct thread_param_s *param);
 static ssize_t 	handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
 						   size_t bytes, struct buffer *obuf, bool *header);
 static void 	mirror_header(key_data_t *src, key_data_t *rsp, char *key);
-static ssize_t 	send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf,
+static ssize_t 	send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf, int fd,
 							 ssize_t *len, int flags);
+static ssize_t 	send_chunk(int sock, struct buffer *obuf, struct chunk_s *chunk, size_t target);
+static void 	update_profile(sq_profile_t *profile, u32_t pull_rate, u32_t lead, bool reconnected, bool ranged);
+static struct store_s *store_open(char *name, struct thread_ctx_s *ctx);
+static void 	store_close(struct store_s *store, struct thread_ctx_s *ctx);
+#if SPLICE
+static ssize_t	splice_with_icy(struct thread_ctx_s *ctx, int sock, int fd, u8_t *hbuf,
+							   size_t *hsize, size_t bytes, ssize_t *len);
+#endif
 
 /*---------------------------------------------------------------------------*/
 bool output_start(struct thread_ctx_s *ctx) {
 	struct thread_param_s *param = malloc(sizeof(struct thread_param_s));
 	int i = 0;
+#if SPLICE
+	size_t size = 0;
+#endif
 
 	// start the http server thread (get an available one first)
 	if (ctx->output_thread[0].running) param->thread = ctx->output_thread + 1;
@@ -81,6 +125,41 @@ bool output_start(struct thread_ctx_s *ctx) {
 
 	LOG_INFO("[%p]: start thread %d on port %hu", ctx, param->thread == ctx->output_thread ? 0 : 1, ctx->output.port);
 
+	// undecoded pass-through does not need outputbuf, we read streambuf directly
+	ctx->output.shared = ctx->output.encode.mode == ENCODE_THRU && ctx->output.codec == '*';
+
+	if (ctx->output.shared) {
+		// decoder only looks for the end of stream, so don't wait for it
+		LOCK_D;
+		ctx->output.track_start = ctx->outputbuf->writep;
+		ctx->decode.new_stream = false;
+		UNLOCK_D;
+	}
+
+#if SPLICE
+	/*
+	Even better, pass-through does not need to transit by streambuf and obuf at
+	all, so stream thread splices from LMS socket into a pipe from which this
+	thread splices into renderer's socket. Any previous thread still owns its
+	pipe to drain the end of the previous track
+	*/
+	param->thread->pipe[0] = param->thread->pipe[1] = -1;
+	if (ctx->output.shared && !*ctx->config.store_prefix &&
+		!pipe2(param->thread->pipe, O_NONBLOCK | O_CLOEXEC)) {
+		// pipe size is capped by /proc/sys/fs/pipe-max-size
+		for (size = ctx->config.streambuf_size; size > 65536 &&
+			 fcntl(param->thread->pipe[1], F_SETPIPE_SZ, size) < 0; size /= 2);
+		size = fcntl(param->thread->pipe[1], F_GETPIPE_SZ);
+		ctx->output.shared = false;
+		LOG_INFO("[%p]: splicing pass-through (pipe %zu bytes)", ctx, size);
+	}
+
+	LOCK_S;
+	ctx->stream.splice = param->thread->pipe[1];
+	ctx->stream.splice_size = size;
+	UNLOCK_S;
+#endif
+
 	pthread_create(&param->thread->thread, NULL, (void *(*)(void*)) &output_http_thread, param);
 
 	return true;
@@ -94,6 +173,8 @@ static void output_http_thread(struct thread_param_s *param) {
 	bool acquired = false;
 	size_t hpos = 0, bytes = 0, hsize = 0;
 	ssize_t chunk_count = 0;
+	struct chunk_s chunk = { "" };
+	size_t chunk_size;
 	u8_t *hbuf = malloc(HEAD_SIZE);
 	fd_set rfds, wfds;
 	struct buffer __obuf, *obuf = &__obuf;
@@ -101,16 +182,37 @@ static void output_http_thread(struct thread_param_s *param) {
 	struct thread_ctx_s *ctx = param->ctx;
 	unsigned drain_count = DRAIN_MAX;
 	u32_t start = gettime_ms();
-	FILE *store = NULL;
+	struct store_s *store = NULL;
+	u32_t pull_start = 0, pull_rate = 0, lead = 0;
+	size_t pull_bytes = 0;
+	bool pull_steady = false, pull_held = false;
+	bool reconnected = false, ranged = false;
+	sq_profile_t profile;
+	size_t ahead;
+#if LINUX
+	struct rusage usage;
+	u64_t cpu;
+#endif
+	// pass-through reads streambuf which must be locked before outputbuf
+	bool shared = ctx->output.shared;
 
 	free(param);
-	buf_init(obuf, HTTP_STUB_DEPTH + 512*1024);
+	chunk_size = ctx->config.chunk_size ? min(ctx->config.chunk_size, MAX_CHUNK_SIZE) : MAX_BLOCK;
+#if LINUX
+	// cost of sending, reported per MB at the end
+	getrusage(RUSAGE_THREAD, &usage);
+	cpu = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec;
+#endif
+	// renderers that pull hard get ~2s of look-ahead, rounded to keep pool reuse
+	ahead = min(max(ctx->config.profile.pull_rate * 2, HTTP_AHEAD_MIN), HTTP_AHEAD_MAX);
+	ahead = (ahead + 0x3ffff) & ~0x3ffff;
+	buf_init_pool(obuf, HTTP_STUB_DEPTH + ahead, &ctx->buf_pool);
 
 	if (*ctx->config.store_prefix) {
 		char name[_STR_LEN_];
 		sprintf(name, "%s/#%u#" BRIDGE_URL "%u.%s", ctx->config.store_prefix, thread->http,
 					  thread->index, mimetype2ext(ctx->output.mimetype));
-		store = fopen(name, "wb");
+		store = store_open(name, ctx);
 	}
 
 	/*
@@ -121,9 +223,27 @@ static void output_http_thread(struct thread_param_s *param) {
 
 	while (thread->running) {
 		struct timeval timeout = {0, 0};
-		bool res = true;
+		bool res = true, writing;
+		size_t spliced = 0;
 		int n;
 
+		/*
+		The renderer first pulls as fast as it can to fill its own buffer, so the
+		pull rate window only starts once it held back what we had to send (or at
+		worst PROFILE_WINDOW after connection) and lasts another PROFILE_WINDOW
+		*/
+		if (pull_start && !pull_rate) {
+			u32_t now = gettime_ms();
+
+			if (!pull_steady && (pull_held || now - pull_start > PROFILE_WINDOW)) {
+				pull_steady = true;
+				pull_start = now;
+				pull_bytes = bytes;
+			} else if (pull_steady && now - pull_start > PROFILE_WINDOW) {
+				pull_rate = (u64_t) (bytes - pull_bytes) * 1000 / (now - pull_start);
+			}
+		}
+
 		if (sock == -1 && drain_count) {
 			struct timeval timeout = {0, TIMEOUT*1000};
 
@@ -148,11 +268,15 @@ static void output_http_thread(struct thread_param_s *param) {
 		FD_SET(sock, &rfds);
 
 		// short wait if obuf has free space and there is something to process
-		timeout.tv_usec = _buf_used(ctx->outputbuf) && _buf_space(obuf) > HTTP_STUB_DEPTH ?
+		timeout.tv_usec = _buf_used(shared ? ctx->streambuf : ctx->outputbuf) && _buf_space(obuf) > HTTP_STUB_DEPTH ?
 									TIMEOUT*1000 / 10 : TIMEOUT*1000;
 
+		writing = FD_ISSET(sock, &wfds);
 		n = select(sock + 1, &rfds, &wfds, NULL, &timeout);
 
+		// renderer does not take what we have to send, its buffer is full
+		if (writing && n >= 0 && !FD_ISSET(sock, &wfds) && pull_start) pull_held = true;
+
 		// need to wait till we have an initialized codec
 		if (!acquired && n > 0) {
 			LOCK_D;
@@ -179,6 +303,12 @@ static void output_http_thread(struct thread_param_s *param) {
 
 			http_ready = res = (offset >= 0 && offset <= bytes + 1);
 
+			if (http_ready) {
+				if (!pull_start) pull_start = gettime_ms();
+				if (bytes) reconnected = true;
+				if (offset > 0) ranged = true;
+			}
+
 			// need to re-send header (Sonos)
 			if (http_ready && header) {
 				hpos = hsize;
@@ -188,6 +318,7 @@ static void output_http_thread(struct thread_param_s *param) {
 			// reset chunking and
 			*chunk_frame = '\0';
 			chunk_count = 0;
+			chunk.size = 0;
 		}
 
 		// something wrong happened or master connection closed
@@ -245,11 +376,13 @@ static void output_http_thread(struct thread_param_s *param) {
 			break;
 		}
 
+		if (shared) LOCK_S;
 		LOCK_O;
 
 		// slimproto has not released us yet or we have been stopped
 		if (ctx->output.state != OUTPUT_RUNNING) {
 			UNLOCK_O;
+			if (shared) UNLOCK_S;
 			continue;
 		}
 
@@ -292,33 +425,67 @@ static void output_http_thread(struct thread_param_s *param) {
 			LOG_INFO("[%p]: draining (%zu bytes)", ctx, bytes);
 		}
 
+#if SPLICE
+		// pass-through waiting in pipe, plus head read but not sent yet
+		if (thread->pipe[0] >= 0 && !_buf_used(obuf)) {
+			int used = 0;
+			ioctl(thread->pipe[0], FIONREAD, &used);
+			spliced = used + (hsize > bytes ? hsize - bytes : 0);
+		}
+#endif
+
 		// now are surely running - socket is non blocking, so this is fast
-		if (_buf_used(obuf)) {
+		if (_buf_used(obuf) || spliced || chunk.size) {
 			ssize_t	sent, space;
 
 			// we cannot write, so don't bother
 			if (!FD_ISSET(sock, &wfds)) {
 				FD_SET(sock, &wfds);
 				UNLOCK_O;
+				if (shared) UNLOCK_S;
+				continue;
+			}
+
+			// chunk header, data (even across wrap) and trailer in a single write
+			if (ctx->output.chunked && !spliced && !ctx->output.icy.interval) {
+				space = send_chunk(sock, obuf, &chunk, chunk_size);
+
+				if (space && bytes < HEAD_SIZE) {
+					size_t n = min(space, HEAD_SIZE - bytes), cont = min(n, _buf_cont_read(obuf));
+					memcpy(hbuf + bytes, _buf_readp(obuf), cont);
+					memcpy(hbuf + bytes + cont, obuf->buf, n - cont);
+					hsize += n;
+				}
+
+				_buf_inc_readp(obuf, space);
+				bytes += space;
+
+				UNLOCK_O;
+				if (shared) UNLOCK_S;
 				continue;
 			}
 
-			space = min(_buf_cont_read(obuf), MAX_BLOCK);
+			space = min(spliced ? spliced : _buf_cont_read(obuf), MAX_BLOCK);
 
 			// if chunked mode start by sending the header
 			if (chunk_count) space = min(space, chunk_count);
 			else if (ctx->output.chunked) {
-				chunk_count = min(space, MAX_CHUNK_SIZE);
+				chunk_count = min(space, chunk_size);
 				sprintf(chunk_frame_buf, "%zx\r\n", chunk_count);
 				chunk_frame = chunk_frame_buf;
 				UNLOCK_O;
+				if (shared) UNLOCK_S;
 				continue;
 			}
 
-			sent = send_with_icy(ctx, sock, (void*) _buf_readp(obuf), &space, 0);
+#if SPLICE
+			if (spliced) sent = splice_with_icy(ctx, sock, thread->pipe[0], hbuf, &hsize, bytes, &space);
+			else
+#endif
+			sent = send_with_icy(ctx, sock, (void*) _buf_readp(obuf), -1, &space, 0);
 
 			if (sent > 0) {
-				if (bytes < HEAD_SIZE) {
+				if (bytes < HEAD_SIZE && !spliced) {
 					memcpy(hbuf + bytes, _buf_readp(obuf), min(space, HEAD_SIZE - bytes));
 					hsize += min(space, HEAD_SIZE - bytes);
 				}
@@ -332,7 +499,7 @@ static void output_http_thread(struct thread_param_s *param) {
 					}
 				}
 
-				_buf_inc_readp(obuf, space);
+				if (!spliced) _buf_inc_readp(obuf, space);
 				bytes += space;
 
 				LOG_SDEBUG("[%p] sent %u bytes (total: %u)", ctx, space, bytes);
@@ -340,6 +507,9 @@ static void output_http_thread(struct thread_param_s *param) {
 		} else {
 			// check if all sent
 			if (!drain_count) {
+				if (!done && ctx->render.duration > ctx->render.ms_played && !ctx->output.encode.flow) {
+					lead = ctx->render.duration - ctx->render.ms_played;
+				}
 				if (ctx->output.chunked) {
 					strcpy(chunk_frame_buf, "0\r\n\r\n");
 					chunk_frame = chunk_frame_buf;
@@ -351,15 +521,28 @@ static void output_http_thread(struct thread_param_s *param) {
 		}
 
 		UNLOCK_O;
+		if (shared) UNLOCK_S;
 	}
 
 	NFREE(hbuf);
-	if (acquired) buf_destroy(obuf);
+	buf_destroy(obuf);
 
 	// in chunked mode, a full chunk might not have been sent (due to TCP)
 	if (sock != -1) shutdown_socket(sock);
 	shutdown_socket(thread->http);
-	if (store) fclose(store);
+	if (store) store_close(store, ctx);
+
+#if SPLICE
+	if (thread->pipe[0] >= 0) {
+		// stream thread might still be writing if we have been stopped
+		LOCK_S;
+		if (ctx->stream.splice == thread->pipe[1]) ctx->stream.splice = -1;
+		UNLOCK_S;
+		close(thread->pipe[0]);
+		close(thread->pipe[1]);
+		thread->pipe[0] = thread->pipe[1] = -1;
+	}
+#endif
 
 	LOCK_O;
 	thread->http = -1;
@@ -370,19 +553,264 @@ static void output_http_thread(struct thread_param_s *param) {
 		// need to have slimproto move on in case of stream failure
 		ctx->output.completed = true;
 	}
+	if (bytes) {
+		update_profile(&ctx->config.profile, pull_rate, lead, reconnected, ranged);
+		profile = ctx->config.profile;
+	}
 	UNLOCK_O;
 
+	// let the bridge persist what has been learned
+	if (bytes) ctx_callback(ctx, SQ_SETPROFILE, NULL, &profile);
+
 	LOG_INFO("[%p]: end thread %d (%zu bytes)", ctx, thread == ctx->output_thread ? 0 : 1, bytes);
+
+#if LINUX
+	getrusage(RUSAGE_THREAD, &usage);
+	cpu = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec - cpu;
+	if (bytes) LOG_INFO("[%p]: cpu %u us/MB (chunk %zu)", ctx, (u32_t) (cpu * 1024 * 1024 / bytes), ctx->output.chunked ? chunk_size : 0);
+#endif
+}
+
+/*----------------------------------------------------------------------------*/
+static ssize_t store_flush(int fd, u8_t *data, size_t len) {
+	ssize_t n, done = 0;
+
+	while (done < len && (n = write(fd, data + done, len - done)) > 0) done += n;
+	return done;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *store_thread(struct store_s *store) {
+	mutex_lock(store->mutex);
+
+	// all full slots are written before exiting, the partial one is left to store_close
+	while (store->running || store->tail != store->head) {
+		u8_t *data;
+		ssize_t n;
+
+		if (store->tail == store->head) {
+			cond_timedwait(store->ready, store->mutex, 1000);
+			continue;
+		}
+
+		data = store->slot[store->tail];
+		mutex_unlock(store->mutex);
+
+		n = store_flush(store->fd, data, STORE_SLOT_SIZE);
+
+		mutex_lock(store->mutex);
+		store->written += n;
+		store->dropped += STORE_SLOT_SIZE - n;
+		store->tail = (store->tail + 1) % STORE_SLOTS;
+	}
+
+	mutex_unlock(store->mutex);
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static struct store_s *store_open(char *name, struct thread_ctx_s *ctx) {
+	struct store_s *store = calloc(1, sizeof(struct store_s));
+	int i;
+
+	/*
+	Slots are page-aligned and page-sized multiples so that the file can be
+	opened with O_DIRECT on Linux, which keeps captures out of the page cache.
+	Some filesystems (tmpfs) refuse it, then just use regular writes
+	*/
+#if LINUX
+	store->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (store->fd < 0)
+#endif
+#if WIN
+	store->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+#else
+	store->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+
+	for (i = 0; i < STORE_SLOTS && store->fd >= 0; i++) {
+#if WIN
+		store->slot[i] = _aligned_malloc(STORE_SLOT_SIZE, 4096);
+#else
+		if (posix_memalign((void**) &store->slot[i], 4096, STORE_SLOT_SIZE)) store->slot[i] = NULL;
+#endif
+		if (!store->slot[i]) break;
+	}
+
+	if (i < STORE_SLOTS) {
+		LOG_ERROR("[%p]: cannot capture to %s (%s)", ctx, name, strerror(errno));
+		store->running = false;
+		store_close(store, ctx);
+		return NULL;
+	}
+
+	store->running = true;
+	mutex_create(store->mutex);
+	cond_create(store->ready);
+	pthread_create(&store->thread, NULL, (void *(*)(void*)) &store_thread, store);
+
+	LOG_INFO("[%p]: capturing to %s", ctx, name);
+
+	return store;
+}
+
+/*----------------------------------------------------------------------------*/
+static void store_close(struct store_s *store, struct thread_ctx_s *ctx) {
+	int i;
+
+	if (store->running) {
+		mutex_lock(store->mutex);
+		store->running = false;
+		cond_signal(store->ready);
+		mutex_unlock(store->mutex);
+
+		pthread_join(store->thread, NULL);
+		mutex_destroy(store->mutex);
+		cond_destroy(store->ready);
+
+		// last slot is partial, which O_DIRECT would refuse
+#if LINUX
+		fcntl(store->fd, F_SETFL, fcntl(store->fd, F_GETFL) & ~O_DIRECT);
+#endif
+		store->written += store_flush(store->fd, store->slot[store->head], store->fill);
+
+		if (store->dropped) LOG_WARN("[%p]: capture dropped %zu bytes", ctx, store->dropped);
+		LOG_INFO("[%p]: captured %zu bytes", ctx, store->written);
+	}
+
+	if (store->fd >= 0) close(store->fd);
+
+	for (i = 0; i < STORE_SLOTS; i++) {
+#if WIN
+		_aligned_free(store->slot[i]);
+#else
+		free(store->slot[i]);
+#endif
+	}
+
+	free(store);
+}
+
+/*----------------------------------------------------------------------------*/
+// called from _output_fill with LOCK_O, so it must only copy
+void store_write(struct store_s *store, const void *data, size_t len) {
+	mutex_lock(store->mutex);
+
+	while (len) {
+		size_t n;
+
+		// current slot is full, queue it if there is room otherwise drop
+		if (store->fill == STORE_SLOT_SIZE) {
+			unsigned next = (store->head + 1) % STORE_SLOTS;
+
+			if (next == store->tail) {
+				store->dropped += len;
+				break;
+			}
+
+			store->head = next;
+			store->fill = 0;
+			cond_signal(store->ready);
+		}
+
+		n = min(len, STORE_SLOT_SIZE - store->fill);
+		memcpy(store->slot[store->head] + store->fill, data, n);
+		store->fill += n;
+		data = (u8_t*) data + n;
+		len -= n;
+	}
+
+	mutex_unlock(store->mutex);
 }
 
 /*----------------------------------------------------------------------------*/
-static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf, ssize_t *len, int flags) {
+static void update_profile(sq_profile_t *profile, u32_t pull_rate, u32_t lead, bool reconnected, bool ranged) {
+	// old sessions fade out so that a firmware update gets noticed
+	if (++profile->streams > PROFILE_HISTORY) {
+		profile->streams /= 2;
+		profile->reconnects /= 2;
+		profile->ranges /= 2;
+	}
+
+	if (reconnected) profile->reconnects++;
+	if (ranged) profile->ranges++;
+
+	if (pull_rate) profile->pull_rate = profile->pull_rate ? (profile->pull_rate * 3 + pull_rate) / 4 : pull_rate;
+	if (lead) profile->lead = profile->lead ? (profile->lead * 3 + lead) / 4 : lead;
+}
+
+/*----------------------------------------------------------------------------*/
+static ssize_t send_chunk(int sock, struct buffer *obuf, struct chunk_s *chunk, size_t target) {
+	struct iovec iov[4];
+	size_t data, left, cont, trailer;
+	ssize_t sent;
+	int n = 0;
+
+	// new chunk as large as target, not bounded by obuf's wrap
+	if (!chunk->size) {
+		chunk->size = min(_buf_used(obuf), target);
+		chunk->hlen = sprintf(chunk->head, "%zx\r\n", chunk->size);
+		chunk->sent = 0;
+	}
+
+	// what's left of header, data and trailer after a partial send
+	data = chunk->sent > chunk->hlen ? min(chunk->sent - chunk->hlen, chunk->size) : 0;
+	trailer = chunk->sent > chunk->hlen + chunk->size ? chunk->sent - chunk->hlen - chunk->size : 0;
+	left = chunk->size - data;
+	cont = min(left, _buf_cont_read(obuf));
+
+	if (chunk->sent < chunk->hlen) iov[n++] = (struct iovec) { chunk->head + chunk->sent, chunk->hlen - chunk->sent };
+	if (cont) iov[n++] = (struct iovec) { _buf_readp(obuf), cont };
+	if (left > cont) iov[n++] = (struct iovec) { obuf->buf, left - cont };
+	iov[n++] = (struct iovec) { (char*) "\r\n" + trailer, 2 - trailer };
+
+	sent = writev(sock, iov, n);
+	if (sent <= 0) return 0;
+
+	chunk->sent += sent;
+
+	// audio bytes sent this time
+	sent = min(chunk->sent > chunk->hlen ? chunk->sent - chunk->hlen : 0, chunk->size) - data;
+	if (chunk->sent == chunk->hlen + chunk->size + 2) chunk->size = 0;
+
+	return sent;
+}
+
+/*----------------------------------------------------------------------------*/
+static ssize_t send_data(int sock, const void *buf, int fd, size_t len, int flags) {
+#if SPLICE
+	// no buffer means data are spliced from fd
+	if (!buf) return splice(fd, NULL, sock, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+#endif
+	return send(sock, buf, len, flags);
+}
+
+#if SPLICE
+/*----------------------------------------------------------------------------*/
+static ssize_t splice_with_icy(struct thread_ctx_s *ctx, int sock, int fd, u8_t *hbuf,
+							   size_t *hsize, size_t bytes, ssize_t *len) {
+	// head might have to be re-sent (Sonos) so it goes through hbuf
+	if (bytes < HEAD_SIZE) {
+		if (*hsize == bytes) {
+			ssize_t n = read(fd, hbuf + *hsize, min(*len, HEAD_SIZE - *hsize));
+			if (n > 0) *hsize += n;
+		}
+		*len = min(*len, *hsize - bytes);
+		return send_with_icy(ctx, sock, hbuf + bytes, -1, len, 0);
+	}
+
+	return send_with_icy(ctx, sock, NULL, fd, len, 0);
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf, int fd, ssize_t *len, int flags) {
 	struct outputstate *p = &ctx->output;
 	ssize_t bytes = 0;
 
 	// ICY not active, just send
 	if (!p->icy.interval) {
-		bytes = send(sock, buf, *len, flags);
+		bytes = send_data(sock, buf, fd, *len, flags);
 		if (bytes > 0) *len = bytes;
 		else *len = 0;
 		return *len;
@@ -427,7 +855,7 @@ static ssize_t send_with_icy(struct thread_ctx_s *ctx, int sock, const void *buf
 	// write data if remaining space and no icy to send (if icy send was partial)
 	if (!p->icy.count && bytes < *len) {
 		*len = min(*len - bytes, p->icy.remain);
-		*len = send(sock, buf, *len, flags);
+		*len = send_data(sock, buf, fd, *len, flags);
 		// socket is non-blocking
 		if (*len < 0) *len = 0;
 		else p->icy.remain -= *len;
@@ -487,13 +915,19 @@ static ssize_t handle_http(struct thread_ctx_s *ctx, int sock, int thread_index,
 	if (ctx->config.send_icy && (!ctx->output.duration || ctx->output.encode.flow) &&
 		(format == 'm' || format == 'a') &&
 		((str = kd_lookup(headers, "Icy-MetaData")) != NULL) && atol(str)) {
-		asprintf(&str, "%u", ICY_INTERVAL);
-		kd_add(resp, "icy-metaint", str);
-		free(str);
 		LOCK_O;
-		ctx->output.icy.interval = ctx->output.icy.remain = ICY_INTERVAL;
-		ctx->output.icy.updated = true;
+		if (!ctx->output.icy.buffer) ctx->output.icy.buffer = malloc(ICY_LEN_MAX);
+		// only advertise ICY if we can build metadata
+		if (ctx->output.icy.buffer) {
+			ctx->output.icy.interval = ctx->output.icy.remain = ICY_INTERVAL;
+			ctx->output.icy.updated = true;
+		} else ctx->output.icy.interval = 0;
 		UNLOCK_O;
+		if (ctx->output.icy.interval) {
+			asprintf(&str, "%u", ICY_INTERVAL);
+			kd_add(resp, "icy-metaint", str);
+			free(str);
+		} else LOG_WARN("[%p]: no memory for ICY metadata", ctx);
 	} else ctx->output.icy.interval = 0;
 
 	// are we opening the expected file
@@ -51,13 +51,16 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 	frames_t frames;
 	u8_t *iptr, ibuf[BYTES_PER_FRAME];
 	u32_t *optr;
+	bool eos;
 
 	LOCK_S;
-	LOCK_O_direct;
+	eos = ctx->stream.state <= DISCONNECT;
+	UNLOCK_S;
 
-	iptr = (u8_t *)ctx->streambuf->readp;
+	// buffers are only locked to move pointers, samples are unpacked unlocked
+	iptr = buf_reserve_read(ctx->streambuf, &bytes);
 
-	if (ctx->decode.new_stream && ctx->output.in_endian && !(*((u64_t*) iptr)) &&
+	if (ctx->decode.new_stream && ctx->output.in_endian && bytes >= 8 && !(*((u64_t*) iptr)) &&
 		   (strstr(ctx->server_version, "7.7") || strstr(ctx->server_version, "7.8")) &&
 		   !ctx->config.roon_mode) {
 		/*
@@ -66,30 +69,19 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		but it is a mess for 24 bits ... so this tries to guess what we are
 		receiving
 		*/
-		_buf_inc_readp(ctx->streambuf, 8);
+		buf_commit_read(ctx->streambuf, 8);
+		iptr = buf_reserve_read(ctx->streambuf, &bytes);
 		LOG_INFO("[%p]: guessing a AIFF extra header", ctx);
 	}
 
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
 	bytes_per_frame = (ctx->output.sample_size * ctx->output.channels) / 8;
 
-	if (ctx->stream.state <= DISCONNECT && bytes == 0) {
-		UNLOCK_O_direct;
-		UNLOCK_S;
-		return DECODE_COMPLETE;
-	}
+	if (eos && bytes == 0) return DECODE_COMPLETE;
 
 	in = bytes / bytes_per_frame;
 
-	IF_DIRECT(
-		out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
-	);
-	IF_PROCESS(
-		out = ctx->process.max_in_frames;
-	);
-
 	if (ctx->decode.new_stream) {
-		LOCK_O_not_direct;
+		LOCK_O;
 
 		ctx->output.direct_sample_rate = ctx->output.sample_rate;
 		ctx->output.sample_rate = decode_newstream(ctx->output.sample_rate, ctx->output.supported_rates, ctx);
@@ -97,25 +89,28 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
 
-		UNLOCK_O_not_direct;
-
-		IF_PROCESS(
-			out = ctx->process.max_in_frames;
-		);
+		UNLOCK_O;
 	}
 
 	IF_DIRECT(
-		optr = (u32_t*) ctx->outputbuf->writep;
+		optr = (u32_t*) buf_reserve_write(ctx->outputbuf, &out);
+		out /= BYTES_PER_FRAME;
 	);
 	IF_PROCESS(
 		optr = (u32_t*) ctx->process.inbuf;
+		out = ctx->process.max_in_frames;
 	);
 
-	if (in == 0 && bytes > 0 && _buf_used(ctx->streambuf) >= bytes_per_frame) {
-		memcpy(ibuf, iptr, bytes);
-		memcpy(ibuf + bytes, ctx->streambuf->buf, bytes_per_frame - bytes);
-		iptr = ibuf;
-		in = 1;
+	// a frame straddles the wrap point, rebuild it
+	if (in == 0 && bytes > 0) {
+		LOCK_S;
+		in = _buf_used(ctx->streambuf) >= bytes_per_frame ? 1 : 0;
+		UNLOCK_S;
+		if (in) {
+			memcpy(ibuf, iptr, bytes);
+			memcpy(ibuf + bytes, ctx->streambuf->buf, bytes_per_frame - bytes);
+			iptr = ibuf;
+		}
 	}
 
 	frames = min(in, out);
@@ -125,129 +120,24 @@ static decode_state pcm_decode(struct thread_ctx_s *ctx) {
 
 	count = frames * ctx->output.channels;
 
-	if (ctx->output.channels == 2) {
-		if (ctx->output.sample_size == 8) {
-			if (!ctx->output.in_endian)	while (count--) *optr++ = *iptr++ << 24;
-			else while (count--) *optr++ = (*iptr++ ^ 0x80) << 24;
-		} else if (ctx->output.sample_size == 16) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16;
-					iptr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) << 16 | *(iptr+1) << 24;
-					iptr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 24) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8;
-					iptr += 3;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) << 8 | *(iptr+1) << 16 | *(iptr+2) << 24;
-					iptr += 3;
-				}
-			}
-		} else if (ctx->output.sample_size == 32) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8 | *(iptr+3);
-					iptr += 4;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) | *(iptr+1) << 8 | *(iptr+2) << 16 | *(iptr+3) << 24;
-					iptr += 4;
-				}
-			}
-		}
-	} else if (ctx->output.channels == 1) {
-		if (ctx->output.sample_size == 8) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *iptr++ << 24;
-					*(optr+1) = *optr;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = (*iptr++ ^ 0x80) << 24;
-					*(optr+1) = *optr;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 16) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *(iptr) << 24 | *(iptr+1) << 16;
-					*(optr+1) = *optr;
-					iptr += 2;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = *(iptr) << 16 | *(iptr+1) << 24;
-					*(optr+1) = *optr;
-					iptr += 2;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 24) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8;
-					*(optr+1) = *optr;
-					iptr += 3;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr = *(iptr) << 8 | *(iptr+1) << 16 | *(iptr+2) << 24;
-					*(optr+1) = *optr;
-					iptr += 3;
-					optr += 2;
-				}
-			}
-		} else if (ctx->output.sample_size == 32) {
-			if (!ctx->output.in_endian) {
-				while (count--) {
-					*optr++ = *(iptr) << 24 | *(iptr+1) << 16 | *(iptr+2) << 8 | *(iptr+3);
-					*(optr+1) = *optr;
-					iptr += 4;
-					optr += 2;
-				}
-			} else {
-				while (count--) {
-					*optr++ = *(iptr) | *(iptr+1) << 8 | *(iptr+2) << 16 | *(iptr+3) << 24;
-					*(optr+1) = *optr;
-					iptr += 4;
-					optr += 2;
-				}
-			}
-		}
+	if ((ctx->output.channels == 1 || ctx->output.channels == 2) &&
+		ctx->output.sample_size >= 8 && ctx->output.sample_size <= 32 && !(ctx->output.sample_size % 8)) {
+		conv_unpack[ctx->output.channels - 1][ctx->output.in_endian ? 1 : 0][ctx->output.sample_size / 8 - 1](iptr, optr, count);
 	} else {
 		LOG_ERROR("[%p]: unsupported channels", ctx, ctx->output.channels);
 	}
 
 	LOG_SDEBUG("[%p]: decoded %u frames", ctx, frames);
 
-	_buf_inc_readp(ctx->streambuf, frames * bytes_per_frame);
+	buf_commit_read(ctx->streambuf, frames * bytes_per_frame);
 
 	IF_DIRECT(
-		_buf_inc_writep(ctx->outputbuf, frames * BYTES_PER_FRAME);
+		buf_commit_write(ctx->outputbuf, frames * BYTES_PER_FRAME);
 	);
 	IF_PROCESS(
 		ctx->process.in_frames = frames;
 	);
 
-	UNLOCK_O_direct;
-	UNLOCK_S;
-
 	return DECODE_RUNNING;
 }
 
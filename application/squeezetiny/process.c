@@ -49,7 +49,7 @@ static log_level 	*loglevel = &decode_loglevel;
 static void _write_samples(struct thread_ctx_s *ctx) {
 	size_t frames = ctx->process.out_frames;
 	u16_t *iptr   = (u16_t *) ctx->process.outbuf;
-	unsigned cnt  = 10;
+	u32_t timeout = gettime_ms() + 100;
 
 	LOCK_O;
 
@@ -69,12 +69,11 @@ static void _write_samples(struct thread_ctx_s *ctx) {
 			_buf_inc_writep(ctx->outputbuf, f * BYTES_PER_FRAME);
 			iptr += f * BYTES_PER_FRAME / sizeof(*iptr);
 
-		} else if (cnt--) {
+		} else if ((s32_t) (timeout - gettime_ms()) > 0 &&
+				   _buf_wait_space(ctx->outputbuf, timeout - gettime_ms())) {
 
 			// there should normally be space in the output buffer, but may need to wait during drain phase
-			UNLOCK_O;
-			usleep(10000);
-			LOCK_O;
+			continue;
 
 		} else {
 
@@ -88,27 +87,51 @@ static void _write_samples(struct thread_ctx_s *ctx) {
 	UNLOCK_O;
 }
 
+// run processing, directly into outputbuf when it has enough contiguous space, else into outbuf
+static bool _process(bool drain, struct thread_ctx_s *ctx) {
+	bool done = true;
+	size_t space;
+	u8_t *optr;
+
+	ctx->process.out_frames = 0;
+
+	// we are the only writer (LOCK_D held), so reserved space can't shrink while unlocked
+	optr = buf_reserve_write(ctx->outputbuf, &space);
+
+	if (space >= ctx->process.max_out_frames * BYTES_PER_FRAME) {
+
+		ctx->process.outp = optr;
+
+		if (drain) done = DRAIN_FUNC(ctx);
+		else SAMPLES_FUNC(ctx);
+
+		buf_commit_write(ctx->outputbuf, ctx->process.out_frames * BYTES_PER_FRAME);
+
+	} else {
+
+		ctx->process.outp = ctx->process.outbuf;
+
+		if (drain) done = DRAIN_FUNC(ctx);
+		else SAMPLES_FUNC(ctx);
+
+		_write_samples(ctx);
+	}
+
+	return done;
+}
+
 // process samples - called with decode mutex set
 void process_samples(struct thread_ctx_s *ctx) {
 
-	SAMPLES_FUNC(ctx);
-
-	_write_samples(ctx);
+	_process(false, ctx);
 
 	ctx->process.in_frames = 0;
 }
 
 // drain at end of track - called with decode mutex set
 void process_drain(struct thread_ctx_s *ctx) {
-	bool done;
-
-	do {
-
-		done = DRAIN_FUNC(ctx);
-
-		_write_samples(ctx);
 
-	} while (!done);
+	while (!_process(true, ctx));
 
 	LOG_DEBUG("[%p]: processing track complete - frames in: %lu out: %lu", ctx, ctx->process.total_in, ctx->process.total_out);
 }
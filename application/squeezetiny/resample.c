@@ -47,9 +47,7 @@ struct  {
 	void (* soxr_delete)(soxr_t);
 	soxr_error_t (* soxr_process)(soxr_t, soxr_in_t, size_t, size_t *, soxr_out_t, size_t olen, size_t *);
 	size_t *(* soxr_num_clips)(soxr_t);
-#if RESAMPLE_MP
 	soxr_runtime_spec_t (* soxr_runtime_spec)(unsigned num_threads);
-#endif
 	// soxr_strerror is a macro so not included here
 } gr;
 #endif
@@ -64,10 +62,20 @@ struct soxr {
 	double q_passband_end;      /* 0dB pt. bandwidth to preserve; nyquist=1  0.913 */
 	double q_stopband_begin;    /* Aliasing/imaging control; > passband_end   1    */
 	double scale;
+	unsigned q_threads;			/* requested soxr threads, 0 = fair share of budget */
+	unsigned threads;			/* threads currently borrowed from budget */
 	bool max_rate;
 	bool exception;
 };
 
+// soxr threads are shared by all players, each resampler borrows from this
+static struct {
+	mutex_type mutex;
+	int size, used;
+	int players;				// players currently holding a resampler
+} budget;
+
+
 
 #if LINKALL
 #define SOXR(h, fn, ...) (soxr_ ## fn)(__VA_ARGS__)
@@ -76,13 +84,50 @@ struct soxr {
 #endif
 
 
+/*---------------------------------------------------------------------------*/
+static unsigned budget_acquire(unsigned wanted) {
+	int granted;
+
+	mutex_lock(budget.mutex);
+	budget.players++;
+	granted = budget.size - budget.used;
+	// by default, don't let a player take more than its share of active resamplers
+	if (!wanted) wanted = max(budget.size / max(budget.players, 1), 1);
+	if ((int) wanted < granted) granted = wanted;
+	// a resampler always runs, even when budget is exhausted
+	if (granted < 1) granted = 1;
+	budget.used += granted;
+	mutex_unlock(budget.mutex);
+
+	return granted;
+}
+
+/*---------------------------------------------------------------------------*/
+static void budget_release(struct soxr *r) {
+	mutex_lock(budget.mutex);
+	budget.used -= r->threads;
+	budget.players--;
+	mutex_unlock(budget.mutex);
+	r->threads = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void delete_resampler(struct soxr *r) {
+	if (!r->resampler) return;
+
+	SOXR(&gr, delete, r->resampler);
+	r->resampler = NULL;
+	budget_release(r);
+}
+
+
 void resample_samples(struct thread_ctx_s *ctx) {
 	struct soxr *r = ctx->decode.process_handle;
 	size_t idone, odone;
 	size_t clip_cnt;
 
 	soxr_error_t error =
-		SOXR(&gr, process, r->resampler, ctx->process.inbuf, ctx->process.in_frames, &idone, ctx->process.outbuf, ctx->process.max_out_frames, &odone);
+		SOXR(&gr, process, r->resampler, ctx->process.inbuf, ctx->process.in_frames, &idone, ctx->process.outp, ctx->process.max_out_frames, &odone);
 	if (error) {
 		LOG_INFO("[%p]: soxr_process error: %s", ctx, soxr_strerror(error));
 		return;
@@ -110,7 +155,7 @@ bool resample_drain(struct thread_ctx_s *ctx) {
 	size_t odone;
 	size_t clip_cnt;
 
-	soxr_error_t error = SOXR(&gr, process, r->resampler, NULL, 0, NULL, ctx->process.outbuf, ctx->process.max_out_frames, &odone);
+	soxr_error_t error = SOXR(&gr, process, r->resampler, NULL, 0, NULL, ctx->process.outp, ctx->process.max_out_frames, &odone);
 	if (error) {
 		LOG_INFO("[%p]: soxr_process error: %s", ctx, soxr_strerror(error));
 		return true;
@@ -129,8 +174,7 @@ bool resample_drain(struct thread_ctx_s *ctx) {
 
 		LOG_INFO("[%p]: resample track complete - total track clips: %u", ctx, r->old_clips);
 
-		SOXR(&gr, delete, r->resampler);
-		r->resampler = NULL;
+		delete_resampler(r);
 
 		return true;
 
@@ -187,19 +231,14 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 	ctx->process.in_sample_rate = raw_sample_rate;
 	ctx->process.out_sample_rate = outrate;
 
-	if (r->resampler) {
-		SOXR(&gr, delete, r->resampler);
-		r->resampler = NULL;
-	}
+	delete_resampler(r);
 
 	if (raw_sample_rate != outrate) {
 
 		soxr_io_spec_t io_spec;
 		soxr_quality_spec_t q_spec;
 		soxr_error_t error;
-#if RESAMPLE_MP
 		soxr_runtime_spec_t r_spec;
-#endif
 
 		LOG_INFO("[%p]: resampling from %u -> %u", ctx, raw_sample_rate, outrate);
 
@@ -220,22 +259,19 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 			q_spec.phase_response = r->q_phase_response;
 		}
 
-#if RESAMPLE_MP
-		r_spec = SOXR(&gr, runtime_spec, 0); // make use of libsoxr OpenMP support allowing parallel execution if multiple cores
-#endif
+		// libsoxr OpenMP support allows parallel execution if multiple cores
+		r->threads = budget_acquire(r->q_threads);
+		r_spec = SOXR(&gr, runtime_spec, r->threads);
 
 		LOG_DEBUG("[%p]: resampling with soxr_quality_spec_t[precision: %03.1f, passband_end: %03.6f, stopband_begin: %03.6f, "
-				  "phase_response: %03.1f, flags: 0x%02x], soxr_io_spec_t[scale: %03.2f]", ctx, q_spec.precision,
-				  q_spec.passband_end, q_spec.stopband_begin, q_spec.phase_response, q_spec.flags, io_spec.scale);
+				  "phase_response: %03.1f, flags: 0x%02x], soxr_io_spec_t[scale: %03.2f], threads: %u", ctx, q_spec.precision,
+				  q_spec.passband_end, q_spec.stopband_begin, q_spec.phase_response, q_spec.flags, io_spec.scale, r->threads);
 
-#if RESAMPLE_MP
 		r->resampler = SOXR(&gr, create, raw_sample_rate, outrate, 2, &error, &io_spec, &q_spec, &r_spec);
-#else
-		r->resampler = SOXR(&gr, create, raw_sample_rate, outrate, 2, &error, &io_spec, &q_spec, NULL);
-#endif
 
 		if (error) {
 			LOG_INFO("[%p]: soxr_create error: %s", ctx, soxr_strerror(error));
+			budget_release(r);
 			return false;
 		}
 
@@ -252,10 +288,7 @@ bool resample_newstream(unsigned raw_sample_rate, int supported_rates[], struct
 void resample_flush(struct thread_ctx_s *ctx) {
 	struct soxr *r = ctx->decode.process_handle;
 
-	if (r->resampler) {
-		SOXR(&gr, delete, r->resampler);
-		r->resampler = NULL;
-	}
+	delete_resampler(r);
 }
 
 
@@ -264,6 +297,7 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	char *recipe = NULL, *flags = NULL;
 	char *atten = NULL;
 	char *precision = NULL, *passband_end = NULL, *stopband_begin = NULL, *phase_response = NULL;
+	char *threads = NULL;
 
 #if !LINKALL
 	if (!gr.handle) return false;
@@ -277,6 +311,8 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 
 	r->resampler = NULL;
 	r->old_clips = 0;
+	r->threads = 0;
+
 	// do not try to go max_rate
 	r->max_rate = false;
 	// do not rsample if matching !
@@ -290,6 +326,7 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 		passband_end = next_param(NULL, ':');
 		stopband_begin = next_param(NULL, ':');
 		phase_response = next_param(NULL, ':');
+		threads = next_param(NULL, ':');
 	}
 
 	// default to QQ (16 bit) if not user specified
@@ -302,6 +339,8 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 	r->q_passband_end = 0;
 	r->q_stopband_begin = 0;
 	r->q_phase_response = -1;
+	// use as many threads as budget allows only if soxr has been built with OpenMP
+	r->q_threads = RESAMPLE_MP ? 0 : 1;
 
 	if (recipe && recipe[0] != '\0') {
 		if (strchr(recipe, 'm')) r->q_recipe = SOXR_MQ;
@@ -340,16 +379,24 @@ bool resample_init(char *opt, struct thread_ctx_s *ctx) {
 		r->q_phase_response = atof(phase_response);
 	}
 
-	LOG_INFO("[%p]: resampling %s recipe: 0x%02x, flags: 0x%02x, scale: %03.2f, precision: %03.1f, passband_end: %03.5f, stopband_begin: %03.5f, phase_response: %03.1f",
+	if (threads) {
+		r->q_threads = atoi(threads);
+	}
+
+	LOG_INFO("[%p]: resampling %s recipe: 0x%02x, flags: 0x%02x, scale: %03.2f, precision: %03.1f, passband_end: %03.5f, stopband_begin: %03.5f, phase_response: %03.1f, threads: %u",
 			ctx, r->max_rate ? "async" : "sync",
-			r->q_recipe, r->q_flags, r->scale, r->q_precision, r->q_passband_end, r->q_stopband_begin, r->q_phase_response);
+			r->q_recipe, r->q_flags, r->scale, r->q_precision, r->q_passband_end, r->q_stopband_begin, r->q_phase_response, r->q_threads);
 
 	return true;
 }
 
 
 void resample_end(struct thread_ctx_s *ctx) {
-	if (ctx->decode.process_handle) free(ctx->decode.process_handle);
+	if (!ctx->decode.process_handle) return;
+
+	delete_resampler(ctx->decode.process_handle);
+	free(ctx->decode.process_handle);
+	ctx->decode.process_handle = NULL;
 }
 
 
@@ -369,9 +416,7 @@ static bool load_soxr(void) {
 	gr.soxr_delete = dlsym(gr.handle, "soxr_delete");
 	gr.soxr_process = dlsym(gr.handle, "soxr_process");
 	gr.soxr_num_clips = dlsym(gr.handle, "soxr_num_clips");
-#if RESAMPLE_MP
 	gr.soxr_runtime_spec = dlsym(gr.handle, "soxr_runtime_spec");
-#endif
 
 	if ((err = dlerror()) != NULL) {
 		LOG_INFO("dlerror: %s", err);
@@ -386,19 +431,26 @@ static bool load_soxr(void) {
 
 
 bool register_soxr(void) {
+	// thread budget is the number of cores, shared across all players
+	budget.size = cpu_count();
+	budget.used = budget.players = 0;
+	mutex_create(budget.mutex);
+
 	if (!load_soxr()) {
 		LOG_WARN("resampling disabled", NULL);
 		return false;
 	}
 
-	LOG_INFO("using soxr for resampling", NULL);
+	LOG_INFO("using soxr for resampling (thread budget %d)", budget.size);
 	return true;
 }
 
 void deregister_soxr(void) {
+	mutex_destroy(budget.mutex);
 #if !LINKALL
 	dlclose(gr.handle);
 #endif
 }
 
+
 #endif // #if RESAMPLE
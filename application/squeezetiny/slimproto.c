@@ -71,6 +71,7 @@ static u8_t		pcm_channels[] = { 1, 2 };
 
 static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels,
 						  u8_t endianness, struct thread_ctx_s *ctx);
+static void metadata_finish(bool wait, struct thread_ctx_s *ctx);
 
 /*---------------------------------------------------------------------------*/
 bool ctx_callback(struct thread_ctx_s *ctx, sq_action_t action, u8_t *cookie, void *param)
@@ -229,7 +230,15 @@ static void process_strm(u8_t *pkt, int len, struct thread_ctx_s *ctx) {
 		LOG_INFO("[%p] strm command %c", ctx, strm->command);
 	}
 	else {
-		LOG_DEBUG("[%p] strm command %c", ctx, strm->command);
+		LOG_DEBUG("[%p] strm command %c", ctx, strm->command);
+	}
+
+	// a new track must wait for the pending one to be set on renderer
+	if (strm->command == 's') metadata_finish(true, ctx);
+	else if (strm->command == 'q' || strm->command == 'f') {
+		// set it if already received, otherwise drop it whenever it arrives
+		metadata_finish(false, ctx);
+		ctx->track.discard = ctx->track.pending;
 	}
 
 	switch(strm->command) {
@@ -496,6 +505,47 @@ static void process(u8_t *pack, int len, struct thread_ctx_s *ctx) {
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+// give buffers memory back when player has been idle long enough
+static void idle_release(u32_t now, struct thread_ctx_s *ctx) {
+	bool idle, release = false;
+
+	/*
+	Stream, decoder and output threads can only be restarted from this thread
+	so buffers can't be in use while we resize them. Decoder state is only
+	stable under its own mutex, which comes first
+	*/
+	LOCK_D;
+	LOCK_S;
+	LOCK_O;
+
+	idle = ctx->stream.state == STOPPED && ctx->decode.state != DECODE_RUNNING &&
+		   !ctx->output_thread[0].running && !ctx->output_thread[1].running &&
+		   !ctx->track.pending;
+
+	if (!idle) {
+		ctx->idle_since = 0;
+		ctx->released = false;
+	} else if (!ctx->idle_since) {
+		ctx->idle_since = now;
+	} else if (!ctx->released && now - ctx->idle_since > ctx->config.idle_release * 1000) {
+		_buf_release(ctx->streambuf, STREAMBUF_IDLE_SIZE);
+		_buf_release(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
+		NFREE(ctx->output.icy.buffer);
+		NFREE(ctx->stream.stage);
+		ctx->released = release = true;
+	}
+
+	UNLOCK_O;
+	UNLOCK_S;
+	UNLOCK_D;
+
+	if (release) {
+		buf_pool_trim(&ctx->buf_pool);
+		LOG_INFO("[%p] idle for %us, buffers released", ctx, (now - ctx->idle_since) / 1000);
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 static void slimproto_run(struct thread_ctx_s *ctx) {
 	int  expect = 0;
@@ -577,6 +627,9 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			return;
 		}
 
+		// renderer's track can be set once metadata have been received
+		metadata_finish(false, ctx);
+
 		// update playback state when woken or every 100ms
 		now = gettime_ms();
 
@@ -604,12 +657,16 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			bool _stream_disconnect = false;
 			disconnect_code disconnect_code;
 			size_t header_len = 0;
+			u32_t stream_delay;
 
 			ctx->slim_run.last = now;
 
 			LOCK_S;
 
 			ctx->status.stream_full = _buf_used(ctx->streambuf);
+#if SPLICE
+			ctx->status.stream_full += _stream_spliced(ctx);
+#endif
 			ctx->status.stream_size = ctx->streambuf->size;
 			ctx->status.stream_bytes = ctx->stream.bytes;
 			ctx->status.stream_state = ctx->stream.state;
@@ -705,6 +762,7 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 					ctx->output.state = OUTPUT_RUNNING;
 					UNLOCK_O;
 				}
+				wake_decode(ctx);
 				ctx_callback(ctx, SQ_PLAY, NULL, NULL);
 				// autostart 2 and 3 require cont to be received first
 			}
@@ -724,10 +782,13 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			 the end of the track, which also fits nicely with the requirement
 			 for cross fade (need to have enough of current track in outputbuf
 			 when codec of next track starts)
+			 Renderers that buffer far ahead are done pulling well before the
+			 end and ask for next track early, so have it ready sooner.
 			*/
+			stream_delay = STREAM_DELAY + min(ctx->config.profile.lead, STREAM_DELAY_MAX - STREAM_DELAY);
 			if ((ctx->decode.state == DECODE_COMPLETE && ctx->canSTMdu && ctx->status.output_ready &&
 				(ctx->output.encode.flow || !ctx->output.remote ||
-				 (ctx->status.duration && ctx->status.duration - ctx->status.ms_played < STREAM_DELAY))) ||
+				 (ctx->status.duration && ctx->status.duration - ctx->status.ms_played < stream_delay))) ||
 				ctx->decode.state == DECODE_ERROR) {
 
 				if (ctx->decode.state == DECODE_COMPLETE) _sendSTMd = true;
@@ -755,6 +816,8 @@ static void slimproto_run(struct thread_ctx_s *ctx) {
 			if (_sendSTMn) sendSTAT("STMn", 0, ctx);
 			if (_sendRESP) sendRESP(ctx->slim_run.header, header_len, ctx->sock);
 			if (_sendMETA) sendMETA(ctx->slim_run.header, header_len, ctx->sock);
+
+			if (ctx->config.idle_release) idle_release(now, ctx);
 		}
 	}
 }
@@ -918,6 +981,7 @@ void slimproto_close(struct thread_ctx_s *ctx) {
   	ctx->running = false;
 	wake_controller(ctx);
 	pthread_join(ctx->thread, NULL);
+	metadata_finish(true, ctx);
 	mutex_destroy(ctx->mutex);
 	mutex_destroy(ctx->cli_mutex);
 }
@@ -966,20 +1030,95 @@ void slimproto_thread_init(struct thread_ctx_s *ctx) {
 	pthread_create(&ctx->thread, NULL, (void *(*)(void*)) slimproto, ctx);
 }
 
+/*---------------------------------------------------------------------------*/
+static void *metadata_thread(struct thread_ctx_s *ctx) {
+	// get metadata - they must be freed by callee whenever he wants
+	sq_get_metadata(ctx->self, &ctx->track.info.metadata, ctx->track.info.offset);
+	LOCK_O;
+	ctx->track.ready = true;
+	UNLOCK_O;
+	wake_controller(ctx);
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void metadata_join(struct thread_ctx_s *ctx) {
+	if (!ctx->track.running) return;
+	pthread_join(ctx->track.thread, NULL);
+	ctx->track.running = false;
+}
+
+/*---------------------------------------------------------------------------*/
+static void metadata_finish(bool wait, struct thread_ctx_s *ctx) {
+	struct outputstate *out = &ctx->output;
+	struct track_param *info = &ctx->track.info;
+	bool ready;
+
+	LOCK_O;
+	ready = ctx->track.ready;
+	UNLOCK_O;
+
+	if (!ctx->track.pending || (!wait && !ready)) return;
+
+	metadata_join(ctx);
+	ctx->track.pending = false;
+
+	// track has been stopped or flushed before its metadata arrived
+	if (ctx->track.discard) {
+		sq_free_metadata(&info->metadata);
+		return;
+	}
+
+	LOCK_O;
+	out->duration = info->metadata.duration;
+	out->bitrate = info->metadata.bitrate;
+	out->remote = info->metadata.remote;
+	UNLOCK_O;
+
+	// codec failed or flow already running, only key parameters were needed
+	if (!ctx->track.callback || !ctx->running) {
+		sq_free_metadata(&info->metadata);
+		return;
+	}
+
+	// set ICY metadata if possible
+	if (ctx->config.send_icy && (!out->duration || out->encode.flow))
+		output_set_icy(&info->metadata, true, gettime_ms(), ctx);
+
+	// in case of flow, renderer only gets default metadata
+	if (out->encode.flow) {
+		sq_free_metadata(&info->metadata);
+		sq_default_metadata(&info->metadata, true);
+	}
+
+	info->metadata.sample_rate = ctx->track.sample_rate;
+	info->metadata.sample_size = ctx->track.sample_size;
+	if (ctx->track.channels) info->metadata.channels = ctx->track.channels;
+
+	LOG_INFO("[%p]: metadata received d:%u", ctx, out->duration);
+
+	if (!ctx_callback(ctx, SQ_SET_TRACK, NULL, info)) {
+		LOG_ERROR("[%p] renderer refused track", ctx);
+		sendSTAT("STMn", 0, ctx);
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_t endianness,
 						  struct thread_ctx_s *ctx) {
 	struct outputstate *out = &ctx->output;
-	struct track_param info;
+	struct track_param *info = &ctx->track.info;
 	char *mimetype = NULL, *p, *mode = ctx->config.mode;
-	bool ret = false;
+	bool ret = false, fickle;
 	s32_t sample_rate;
 
+	// previous track must be fully set before a new one starts
+	metadata_finish(true, ctx);
+
 	LOCK_O;
 	// out->index++;
 	// try to handle next track failed stream where we jump over N tracks
-	info.offset = ctx->render.index != -1 ? out->index - ctx->render.index : 0;
-	_buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
+	info->offset = ctx->render.index != -1 ? out->index - ctx->render.index : 0;
 	UNLOCK_O;
 
 	/*
@@ -988,14 +1127,19 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	output context
 	*/
 
-	// get metadata - they must be freed by callee whenever he wants
-	sq_get_metadata(ctx->self, &info.metadata, info.offset);
+	/*
+	CLI query can take a while so it runs in parallel with codec and stream
+	opening. Duration, ICY and renderer's track are set when it answers
+	*/
+	ctx->track.ready = ctx->track.callback = ctx->track.discard = false;
+	ctx->track.pending = true;
+	ctx->track.running = !pthread_create(&ctx->track.thread, NULL, (void *(*)(void*)) metadata_thread, ctx);
+	if (!ctx->track.running) metadata_thread(ctx);
 
-	// set key parameters
+	// set key parameters (duration, bitrate & remote are known later)
 	out->completed = false;
-	out->duration = info.metadata.duration;
-	out->bitrate = info.metadata.bitrate;
-	out->remote = info.metadata.remote;
+	out->duration = out->bitrate = 0;
+	out->remote = false;
 
 	// read source parameters (if any)
 	if (format != 'a')
@@ -1013,7 +1157,9 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 
 	// in flow mode we now have eveything, just initialize codec
 	if (out->encode.flow) {
-		sq_free_metadata(&info.metadata);
+		LOCK_O;
+		_buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
+		UNLOCK_O;
 		return codec_open(out->codec, out->sample_size, out->sample_rate,
 						  out->channels, out->in_endian, ctx);
 	}
@@ -1038,22 +1184,13 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 	out->encode.channels = 0;
 	// reset time offset for new tracks
 	out->offset = 0;
-	// set ICY metadata if possible
-	if (ctx->config.send_icy && (!out->duration || out->encode.flow))
-		output_set_icy(&info.metadata, true, gettime_ms(), ctx);
 
 	// in case of flow, all parameters shall be set
 	if (stristr(mode, "flow") && out->encode.mode != ENCODE_THRU) {
-		if (ctx->config.send_icy) output_set_icy(&info.metadata, true, gettime_ms(), ctx);
-		sq_free_metadata(&info.metadata);
-		sq_default_metadata(&info.metadata, true);
-
 		if (!sample_rate || sample_rate < 0) sample_rate = 44100;
 		if (!out->encode.sample_size) out->encode.sample_size = 16;
 		out->encode.channels = 2;
 		out->encode.flow = true;
-	} else {
-		if (ctx->config.send_icy && !out->duration) output_set_icy(&info.metadata, true, gettime_ms(), ctx);
 	}
 
 	// set sample rate for re-encoding
@@ -1098,19 +1235,22 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 
 	} else if (out->encode.mode == ENCODE_PCM) {
 
+		// source format has to be known when encoding parameters are not fixed
+		if (!out->encode.sample_rate || !out->encode.sample_size) metadata_join(ctx);
+
 		if (out->encode.sample_rate && out->encode.sample_size) {
 			// everything is fixed
 			mimetype = find_pcm_mimetype(&out->encode.sample_size, ctx->config.L24_format == L24_TRUNC16_PCM,
 										 out->encode.sample_rate, 2, ctx->mimetypes, ctx->config.raw_audio_format);
-		} else if ((info.metadata.sample_size || out->encode.sample_size) &&
-				   (info.metadata.sample_rate || out->encode.sample_rate || out->supported_rates[0])) {
-			u8_t sample_size = out->encode.sample_size ? out->encode.sample_size : info.metadata.sample_size;
+		} else if ((info->metadata.sample_size || out->encode.sample_size) &&
+				   (info->metadata.sample_rate || out->encode.sample_rate || out->supported_rates[0])) {
+			u8_t sample_size = out->encode.sample_size ? out->encode.sample_size : info->metadata.sample_size;
 			u32_t sample_rate;
 
 			// try to use source format, but return generic mimetype
 			if (out->encode.sample_rate) sample_rate = out->encode.sample_rate;
-			else if (out->supported_rates[0] < 0) sample_rate = abs(out->supported_rates[0]);
-			else sample_rate = info.metadata.sample_rate;
+			else if (out->supported_rates[0] < 0) sample_rate = abs(out->supported_rates[0]);
+			else sample_rate = info->metadata.sample_rate;
 
 			mimetype = find_pcm_mimetype(&sample_size, ctx->config.L24_format == L24_TRUNC16_PCM,
 										   sample_rate, 2, ctx->mimetypes, ctx->config.raw_audio_format);
@@ -1147,7 +1287,16 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 		} else out->encode.level = 128;
 	}
 
-	// matching found in player
+	// undecoded pass-through reads streambuf directly, outputbuf can stay small
+	LOCK_O;
+	if (out->encode.mode == ENCODE_THRU && out->codec == '*') _buf_release(ctx->outputbuf, OUTPUTBUF_IDLE_SIZE);
+	else _buf_resize(ctx->outputbuf, ctx->config.outputbuf_size);
+	// renderers that keep coming back for more cope better with a length than with chunks
+	fickle = ctx->config.profile.streams >= PROFILE_MIN &&
+			 (ctx->config.profile.reconnects + ctx->config.profile.ranges) * 2 >= ctx->config.profile.streams;
+	UNLOCK_O;
+
+	// matching found in player
 	if (mimetype) {
 		strcpy(out->mimetype, mimetype);
 		free(mimetype);
@@ -1155,28 +1304,33 @@ static bool process_start(u8_t format, u32_t rate, u8_t size, u8_t channels, u8_
 		out->format = mimetype2format(out->mimetype);
 		out->out_endian = (out->format == 'w');
 		out->length = ctx->config.stream_length;
+		if (out->length == HTTP_CHUNKED && fickle) {
+			out->length = HTTP_EXACT_LENGTH;
+			LOG_INFO("[%p]: renderer reconnects, using length instead of chunked", ctx);
+		}
 
 		if (codec_open(out->codec, out->sample_size, out->sample_rate, out->channels,
 			out->in_endian, ctx) &&	output_start(ctx)) {
 
-			strcpy(info.mimetype, out->mimetype);
-			sprintf(info.uri, "http://%s:%hu/" BRIDGE_URL "%u.%s", sq_ip,
+			strcpy(info->mimetype, out->mimetype);
+			sprintf(info->uri, "http://%s:%hu/" BRIDGE_URL "%u.%s", sq_ip,
 					out->port, out->index, mimetype2ext(out->mimetype));
 
 			/*
 			in THRU/PCM mode these values are known when we receive pcm and in
 			PCM, they are known if values are forced. Otherwise we can't know
 			*/
-			info.metadata.sample_rate = out->encode.sample_rate;
-			info.metadata.sample_size = out->encode.sample_size;
+			ctx->track.sample_rate = out->encode.sample_rate;
+			ctx->track.sample_size = out->encode.sample_size;
 			// non-encoded version is needed as encoded one is always reset
-			if (out->channels) info.metadata.channels = out->channels;
+			ctx->track.channels = out->channels;
 
-			ret = ctx_callback(ctx, SQ_SET_TRACK, NULL, &info);
-
-			LOG_INFO("[%p]: codec:%c, ch:%d, s:%d, r:%d", ctx, out->codec, out->channels, out->sample_size, out->sample_rate);
-		} else sq_free_metadata(&info.metadata);
-	}
+			// track is set on renderer once metadata are received
+			ctx->track.callback = ret = true;
+
+			LOG_INFO("[%p]: codec:%c, ch:%d, s:%d, r:%d", ctx, out->codec, out->channels, out->sample_size, out->sample_rate);
+		}
+	}
 
 	return ret;
 }
@@ -106,5 +106,11 @@
 #define thread_type pthread_t
 #define mutex_timedlock(m, t) _mutex_timedlock(&m, t)
 int _mutex_timedlock(mutex_type *m, u32_t wait);
+#define cond_type pthread_cond_t
+#define cond_create(c) pthread_cond_init(&c, NULL)
+#define cond_signal(c) pthread_cond_broadcast(&c)
+#define cond_destroy(c) pthread_cond_destroy(&c)
+#define cond_timedwait(c, m, t) _cond_timedwait(&c, &m, t)
+int _cond_timedwait(cond_type *c, mutex_type *m, u32_t wait);
 
 #endif     // __SQUEEZEDEFS_H
@@ -34,7 +34,7 @@
 
 typedef enum {SQ_NONE, SQ_SET_TRACK, SQ_PLAY, SQ_TRANSITION, SQ_PAUSE, SQ_UNPAUSE,
 			  SQ_STOP, SQ_SEEK, SQ_VOLUME, SQ_TIME, SQ_TRACK_INFO, SQ_ONOFF,
-			  SQ_NEXT, SQ_SETNAME, SQ_SETSERVER, SQ_BATTERY} sq_action_t;
+			  SQ_NEXT, SQ_SETNAME, SQ_SETSERVER, SQ_BATTERY, SQ_SETPROFILE} sq_action_t;
 typedef enum {SQ_STREAM = 2, SQ_FULL = 3} sq_mode_t;
 typedef	sq_action_t sq_event_t;
 
@@ -67,8 +67,17 @@ typedef struct metadata_s {
 	u8_t  channels;
 } metadata_t;
 
+// renderer's HTTP behaviour, learned over sessions
+typedef struct {
+	u32_t	streams;			// sessions observed (counters halve past PROFILE_HISTORY)
+	u32_t	reconnects;			// sessions where the renderer re-opened the connection
+	u32_t	ranges;				// sessions with a range request
+	u32_t	pull_rate;			// bytes/s pulled once connected, averaged
+	u32_t	lead;				// ms of audio ahead when the renderer finished pulling
+} sq_profile_t;
+
 typedef	struct sq_dev_param_s {
-	enum { HTTP_NO_LENGTH = -1, HTTP_PCM_LENGTH = -2, HTTP_CHUNKED = -3, HTTP_LARGE = MAX_FILE_SIZE } stream_length;
+	enum { HTTP_NO_LENGTH = -1, HTTP_PCM_LENGTH = -2, HTTP_CHUNKED = -3, HTTP_EXACT_LENGTH = -4, HTTP_LARGE = MAX_FILE_SIZE } stream_length;
 	unsigned 	streambuf_size;
 	unsigned 	outputbuf_size;
 	char		codecs[_STR_LEN_];
@@ -87,6 +96,12 @@ typedef	struct sq_dev_param_s {
 #endif
 	bool		roon_mode;
 	char		store_prefix[_STR_LEN_];
+	bool		lock_memory;
+	u32_t		idle_release;		// seconds before idle player gives buffers back
+	u32_t		stream_cushion;		// ms of audio to buffer before playback, 0 to use LMS threshold
+	unsigned	streambuf_min;		// lower bound when streambuf is sized after measured bitrate
+	unsigned	chunk_size;			// target size of HTTP chunks in chunked mode
+	sq_profile_t	profile;		// learned from renderer, persisted with config
 	// set at runtime, not from config
 	struct {
 		bool	use_cli;
@@ -105,7 +120,8 @@ struct track_param
 
 typedef bool (*sq_callback_t)(sq_dev_handle_t handle, void *caller_id, sq_action_t action, u8_t *cookie, void *param);
 
-void				sq_init(char *ip, u16_t port);
+// decode_workers: 0 for a thread per player, -1 for one per core
+void				sq_init(char *ip, u16_t port, int decode_workers);
 void				sq_stop(void);
 
 // only name cannot be NULL
@@ -19,7 +19,7 @@
  *
  */
 
-// make may define: SELFPIPE, RESAMPLE, RESAMPLE_MP, VISEXPORT, DSD, LINKALL to influence build
+// make may define: SELFPIPE, RESAMPLE, RESAMPLE_MP, VISEXPORT, DSD, LINKALL, NOSPLICE, NOMIRROR to influence build
 
 // build detection
 #include "squeezedefs.h"
@@ -40,6 +40,18 @@
 #define WINEVENT  1
 #endif
 
+#if LINUX && !defined(NOSPLICE)
+#define SPLICE    1 // pass-through moves data from LMS to renderer socket in kernel
+#else
+#define SPLICE    0
+#endif
+
+#if LINUX && !defined(NOMIRROR)
+#define MIRROR    1 // streambuf memory is mapped twice so data is contiguous across the wrap
+#else
+#define MIRROR    0
+#endif
+
 #if defined(LINKALL)
 #undef LINKALL
 #define LINKALL   1 // link all libraries at build time - requires all to be available at run time
@@ -210,6 +222,19 @@ void 		touch_memory(u8_t *buf, size_t size);
 #endif
 
 // buffer.c
+#define BUF_POOL_SIZE	4
+
+// memory allocated once per player and recycled for its buffers
+struct buf_pool {
+	mutex_type mutex;
+	bool lock;
+	struct {
+		u8_t *mem;
+		size_t size;
+		bool busy;
+	} item[BUF_POOL_SIZE];
+};
+
 struct buffer {
 	u8_t *buf;
 	u8_t *readp;
@@ -217,7 +242,11 @@ struct buffer {
 	u8_t *wrap;
 	size_t size;
 	size_t base_size;
+	size_t alloc;		// allocated size, can be larger than size
+	struct buf_pool *pool;
+	bool mirror;		// memory is mapped again after wrap
 	mutex_type mutex;
+	cond_type space;	// signalled when readp moves
 };
 
 // _* called with mutex locked
@@ -225,18 +254,30 @@ unsigned 	_buf_used(struct buffer *buf);
 unsigned 	_buf_space(struct buffer *buf);
 unsigned 	_buf_cont_read(struct buffer *buf);
 unsigned 	_buf_cont_write(struct buffer *buf);
+unsigned 	_buf_contiguous(struct buffer *buf);
 void 		_buf_inc_readp(struct buffer *buf, unsigned by);
 void 		_buf_inc_writep(struct buffer *buf, unsigned by);
 unsigned 	_buf_read(void *dst, struct buffer *src, unsigned btes);
 unsigned 	_buf_write(struct buffer *buf, void *src, unsigned size);
+u8_t*		buf_reserve_read(struct buffer *buf, size_t *size);
+void		buf_commit_read(struct buffer *buf, size_t size);
+u8_t*		buf_reserve_write(struct buffer *buf, size_t *size);
+void		buf_commit_write(struct buffer *buf, size_t size);
 void*		_buf_readp(struct buffer *buf);
 unsigned 	_buf_size(struct buffer *src);
 void 		buf_flush(struct buffer *buf);
 void 		buf_adjust(struct buffer *buf, size_t mod);
 void 		_buf_resize(struct buffer *buf, size_t size);
 void 		buf_init(struct buffer *buf, size_t size);
+void 		buf_init_pool(struct buffer *buf, size_t size, struct buf_pool *pool);
+void 		buf_init_mirror(struct buffer *buf, size_t size, struct buf_pool *pool);
 void 		buf_destroy(struct buffer *buf);
+void 		buf_pool_init(struct buf_pool *pool, bool lock);
+void 		buf_pool_destroy(struct buf_pool *pool);
+void 		buf_pool_trim(struct buf_pool *pool);
+void 		_buf_release(struct buffer *buf, size_t size);
 bool 		_buf_reset(struct buffer *buf);
+bool		_buf_wait_space(struct buffer *buf, u32_t wait);
 
 // slimproto.c
 void 		slimproto_close(struct thread_ctx_s *ctx);
@@ -244,6 +285,7 @@ void 		slimproto_reset(struct thread_ctx_s *ctx);
 void 		slimproto_thread_init(struct thread_ctx_s *ctx);
 void 		wake_controller(struct thread_ctx_s *ctx);
 void 		send_packet(u8_t *packet, size_t len, sockfd sock);
+bool 		ctx_callback(struct thread_ctx_s *ctx, sq_action_t action, u8_t *cookie, void *param);
 void 		wake_controller(struct thread_ctx_s *ctx);
 
 // stream.c
@@ -252,6 +294,7 @@ typedef enum { STOPPED = 0, DISCONNECT, STREAMING_WAIT,
 typedef enum { DISCONNECT_OK = 0, LOCAL_DISCONNECT = 1, REMOTE_DISCONNECT = 2, UNREACHABLE = 3, TIMEOUT = 4 } disconnect_code;
 
 #define STREAM_DELAY 15000
+#define STREAM_DELAY_MAX 60000
 
 struct streamstate {
 	stream_state state;
@@ -268,6 +311,18 @@ struct streamstate {
 	u32_t meta_next;
 	u32_t meta_left;
 	bool  meta_send;
+	u8_t  *stage;			// ICY streams are read in bulk then demultiplexed
+	size_t stage_len, stage_pos;
+	struct {				// incoming rate measured while buffering (adaptive mode)
+		u32_t start, last, gap;	// first and latest read, longest wait between reads (ms)
+		u64_t bytes;
+		u32_t rate;				// audio bytes/s of latest stream, kept for next one
+		bool  done;
+	} probe;
+#if SPLICE
+	int splice;				// output thread's pipe when passing-through, -1 otherwise
+	size_t splice_size;
+#endif
 };
 
 bool 		stream_thread_init(struct thread_ctx_s *ctx);
@@ -275,6 +330,9 @@ void 		stream_close(struct thread_ctx_s *ctx);
 void 		stream_file(const char *header, size_t header_len, unsigned threshold, struct thread_ctx_s *ctx);
 void 		stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, unsigned threshold, bool cont_wait, struct thread_ctx_s *ctx);
 bool 		stream_disconnect(struct thread_ctx_s *ctx);
+#if SPLICE
+size_t		_stream_spliced(struct thread_ctx_s *ctx);
+#endif
 
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
@@ -285,6 +343,9 @@ struct decodestate {
 	u32_t frames;
 	mutex_type mutex;
 	void *handle;
+	bool busy;				// owned by a pool worker
+	bool queued, woken;		// runnable by pool workers
+	struct thread_ctx_s *next;
 #if PROCESS
 	void *process_handle;
 	bool direct;
@@ -295,6 +356,7 @@ struct decodestate {
 #if PROCESS
 struct processstate {
 	u8_t *inbuf, *outbuf;
+	u8_t *outp;			// where processing writes: outbuf or directly outputbuf
 	unsigned max_in_frames, max_out_frames;
 	unsigned in_frames, out_frames;
 	unsigned in_sample_rate, out_sample_rate;
@@ -313,16 +375,19 @@ struct codec {
 	decode_state (*decode)(struct thread_ctx_s *ctx);
 };
 
-void 		decode_init(void);
+void 		decode_init(int workers);
 void 		decode_end(void);
 void 		decode_thread_init(struct thread_ctx_s *ctx);
 
 void 		decode_close(struct thread_ctx_s *ctx);
 void 		decode_flush(struct thread_ctx_s *ctx);
+void 		wake_decode(struct thread_ctx_s *ctx);
 unsigned 	decode_newstream(unsigned sample_rate, int supported_rates[],
 							 struct thread_ctx_s *ctx);
 bool 		codec_open(u8_t codec, u8_t sample_size, u32_t sample_rate,
 					   u8_t	channels, u8_t endianness, struct thread_ctx_s *ctx);
+bool		sync_find(u8_t *buf, size_t len, u16_t sync, u16_t mask, size_t *skip);
+bool		marker_find(u8_t *buf, size_t len, char *marker, size_t *skip);
 
 #if PROCESS
 // process.c
@@ -347,10 +412,53 @@ bool 		resample_init(char *opt, struct thread_ctx_s *ctx);
 void 		resample_end(struct thread_ctx_s *ctx);
 #endif
 
+// convert.c
+typedef void (*unpack_t)(u8_t *iptr, u32_t *optr, size_t count);
+extern unpack_t conv_unpack[2][2][4];
+extern void (*conv_fixed)(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned fracbits);
+extern void (*conv_s32)(s32_t *optr, s32_t *iptr, size_t frames, unsigned channels, unsigned shift);
+extern void (*conv_s16)(s32_t *optr, s16_t *iptr, size_t frames, unsigned channels);
+extern void (*conv_planar)(s32_t *optr, s32_t *left, s32_t *right, size_t frames, unsigned shift);
+extern void (*conv_mix)(s32_t *iptr, s32_t *cptr, size_t count, s32_t gain_in, s32_t gain_out, u8_t shift);
+void 		convert_init(void);
+
+// mp4.c
+#define MP4_FOURCC(a,b,c,d) ((u32_t) (a) << 24 | (u32_t) (b) << 16 | (u32_t) (c) << 8 | (u32_t) (d))
+
+struct mp4 {
+	u32_t entry;				// sample entry of wanted codec (mp4a, alac)
+	u32_t pos, consume;			// position in file and bytes still to skip
+	unsigned trak, play;
+	u8_t *config;				// decoder config (esds specific info or alac cookie)
+	u32_t config_len;
+	u32_t sample, sample_count, fixed_size;
+	void *sizes;				// u16_t or u32_t (wide) per sample
+	bool wide;
+	void *offsets;				// u16_t delta to previous or u32_t (wide) per chunk
+	bool wide_offsets;
+	u32_t chunks, chunk, chunk_left, offset;
+	u32_t *stsc, stsc_entries, stsc_index;	// (first chunk, samples per chunk) runs
+	u32_t skip;					// gapless
+	u64_t samples, stts_samples;
+};
+
+void 		mp4_init(struct mp4 *mp4, u32_t entry);
+void 		mp4_close(struct mp4 *mp4);
+int 		_mp4_header(struct mp4 *mp4, struct thread_ctx_s *ctx);
+bool 		_mp4_consume(struct mp4 *mp4, struct thread_ctx_s *ctx);
+bool 		_mp4_next(struct mp4 *mp4, u32_t consumed, struct thread_ctx_s *ctx);
+u32_t 		mp4_sample_size(struct mp4 *mp4);
+
 // output.c
 
 #define	OUTPUTBUF_IDLE_SIZE (256*1024)
+#define	STREAMBUF_IDLE_SIZE (64*1024)
 #define HTTP_STUB_DEPTH		(2048*1024)
+#define HTTP_AHEAD_MIN		(512*1024)
+#define HTTP_AHEAD_MAX		(4096*1024)
+#define PROFILE_WINDOW		5000
+#define PROFILE_HISTORY		32
+#define PROFILE_MIN			4
 
 #define ICY_LEN_MAX		(255*16+1)
 #define ICY_UPDATE_TIME	5000
@@ -370,6 +478,9 @@ struct output_thread_s {
 		thread_type 	thread;
 		int				http;			// listening socket of http server
 		int 			index;
+#if SPLICE
+		int				pipe[2];		// stream thread to http server when splicing
+#endif
 };
 
 // info for the track being sent to the http renderer (not played)
@@ -390,6 +501,7 @@ struct outputstate {
 	u16_t  	index;			// 16 bits track counter(see output_thread)
 	u16_t	port;			// port of latest thread (mainy used for codc)
 	bool 	chunked;		// chunked mode
+	bool	shared;			// pass-through read directly from streambuf, outputbuf unused
 	char 	mimetype[_STR_LEN_];	// content-type to send to player
 	bool  	track_started;	// track has started to be streamed (trigger, not state)
 	u8_t  	*track_start;   // pointer where track starts in buffer, just for legacy compatibility
@@ -398,16 +510,18 @@ struct outputstate {
 	struct {
 		size_t interval, remain;
 		size_t size, count;
-		char buffer[ICY_LEN_MAX];
+		char *buffer;		// ICY_LEN_MAX, only when renderer asks for it
 		char *artist, *title, *artwork;
 		u32_t hash, last;
 		bool  updated;
 	} icy;
 	// for format that requires headers
 	struct {
-		size_t size, count;
-		u8_t *buffer;
+		size_t size, count;	// count is what remains to be sent
+		u8_t buffer[64];	// pre-rendered wav/aif header
 	} header;
+	bool	exact;			// exact length mode, audio is padded/truncated to announced length
+	size_t	exact_left;		// audio bytes left to send in exact length mode
 	// only useful with decode mode
 	fade_state  fade; 		// fading state
 	unsigned 	fade_secs;  // set by slimproto
@@ -451,7 +565,8 @@ void		output_end(void);
 void 		output_set_icy(struct metadata_s *metadata, bool init, u32_t now, struct thread_ctx_s *ctx);
 void 		output_free_icy(struct thread_ctx_s *ctx);
 
-bool		_output_fill(struct buffer *buf, FILE *store, struct thread_ctx_s *ctx);
+struct store_s;
+bool		_output_fill(struct buffer *buf, struct store_s *store, struct thread_ctx_s *ctx);
 void 		_output_new_stream(struct buffer *buf, struct thread_ctx_s *ctx);
 void 		_output_end_stream(struct buffer *buf, struct thread_ctx_s *ctx);
 void 		_checkfade(bool, struct thread_ctx_s *ctx);
@@ -461,6 +576,7 @@ void 		_checkduration(u32_t frames, struct thread_ctx_s *ctx);
 void 		output_flush(struct thread_ctx_s *ctx);
 bool		output_start(struct thread_ctx_s *ctx);
 void 		wake_output(struct thread_ctx_s *ctx);
+void 		store_write(struct store_s *store, const void *data, size_t len);
 
 /***************** main thread context**************/
 typedef struct {
@@ -483,7 +599,7 @@ typedef enum {TRACK_STOPPED = 0, TRACK_STARTED, TRACK_PAUSED} track_status_t;
 
 #define PLAYER_NAME_LEN 64
 #define SERVER_VERSION_LEN	32
-#define MAX_PLAYER		32
+#define MAX_PLAYER		TABLE_MAX
 
 struct thread_ctx_s {
 	int 		self;
@@ -508,6 +624,7 @@ struct thread_ctx_s {
 	struct processstate	process;
 #endif
 	struct codec		*codec;
+	struct buf_pool		buf_pool;
 	struct buffer		__s_buf;
 	struct buffer		__o_buf;
 	struct buffer		*streambuf;
@@ -525,10 +642,19 @@ struct thread_ctx_s {
 	u32_t		cli_timestamp;
 	struct output_thread_s output_thread[2];
 	bool 		decode_running, stream_running;
+	bool		released;		// buffers have been shrunk for idle player
+	u32_t		idle_since;
 	thread_type	decode_thread, stream_thread;
 	struct sockaddr_in serv_addr;
 	#define MAXBUF 4096
 	event_event	wake_e;
+	struct {				// metadata of track being started, fetched asynchronously
+		thread_type	thread;
+		bool		running, ready, pending, callback, discard;
+		u32_t		sample_rate;
+		u8_t		sample_size, channels;
+		struct track_param info;
+	} track;
 	struct 	{				// scratch memory for slimprot_run (was static)
 		 u8_t 	buffer[MAXBUF];
 		 u32_t	last;
@@ -539,7 +665,7 @@ struct thread_ctx_s {
 	u8_t 	last_command;
 };
 
-extern struct thread_ctx_s 	thread_ctx[MAX_PLAYER];
+extern table_t 				thread_ctx;
 extern u16_t 				sq_port;
 extern char  				sq_ip[16];
 
@@ -21,15 +21,32 @@
 
 // stream thread
 
+#define _GNU_SOURCE
+
 #include "squeezelite.h"
 
 #include <fcntl.h>
+#if SPLICE
+#include <sys/ioctl.h>
+#endif
 
 extern log_level	stream_loglevel;
 static log_level 	*loglevel = &stream_loglevel;
 
 #define LOCK_S   mutex_lock(ctx->streambuf->mutex)
 #define UNLOCK_S mutex_unlock(ctx->streambuf->mutex)
+#define LOCK_O   mutex_lock(ctx->outputbuf->mutex)
+#define UNLOCK_O mutex_unlock(ctx->outputbuf->mutex)
+
+#define ICY_STAGE_SIZE	(16*1024)
+#define PROBE_TIME		300		// ms of stream to measure rate in adaptive mode
+#define STREAMBUF_CUSHIONS	4
+
+#if SPLICE
+#define SPLICING	(ctx->stream.splice >= 0)
+#else
+#define SPLICING	false
+#endif
 
 static void send_header(struct thread_ctx_s *ctx) {
 	char *ptr = ctx->stream.header;
@@ -78,8 +95,132 @@ static void _disconnect(stream_state state, disconnect_code disconnect, struct t
 	closesocket(ctx->fd);
 	ctx->fd = -1;
 	wake_controller(ctx);
+	wake_decode(ctx);
+}
+
+#if SPLICE
+/*---------------------------------------------------------------------------*/
+size_t _stream_spliced(struct thread_ctx_s *ctx) {
+	int used = 0;
+
+	// bytes in output thread's pipe, stands for streambuf when splicing
+	if (ctx->stream.splice < 0 || ioctl(ctx->stream.splice, FIONREAD, &used) < 0) return 0;
+	return used;
 }
+#endif
+
+/*---------------------------------------------------------------------------*/
+// called with mutex locked, measure incoming rate and set threshold to get cushion
+static void _probe(int n, struct thread_ctx_s *ctx) {
+	u32_t now = gettime_ms(), rate, bitrate;
+	u64_t threshold;
+
+	if (!ctx->stream.probe.bytes) {
+		ctx->stream.probe.start = ctx->stream.probe.last = now;
+		ctx->stream.probe.gap = 0;
+	}
+
+	ctx->stream.probe.gap = max(ctx->stream.probe.gap, now - ctx->stream.probe.last);
+	ctx->stream.probe.last = now;
+	ctx->stream.probe.bytes += n;
+
+	if (now - ctx->stream.probe.start < PROBE_TIME) return;
+
+	// audio rate is known from metadata (kbps) or assume we receive in real time
+	rate = ctx->stream.probe.bytes * 1000 / (now - ctx->stream.probe.start);
+	LOCK_O;
+	bitrate = ctx->output.bitrate;
+	UNLOCK_O;
+	ctx->stream.probe.rate = bitrate ? bitrate * 1000 / 8 : rate;
+
+	// cushion plus worst wait seen, more if link is slower than audio
+	threshold = (u64_t) ctx->stream.probe.rate * (ctx->config.stream_cushion + ctx->stream.probe.gap) / 1000;
+	if (rate < ctx->stream.probe.rate) threshold = threshold * ctx->stream.probe.rate / rate;
+
+	// must be reachable before streambuf is full
+	ctx->stream.threshold = min(threshold, ctx->streambuf->size * 3 / 4);
+	ctx->stream.probe.done = true;
 
+	LOG_INFO("[%p] link: %u B/s, audio: %u B/s, gap: %u ms => threshold: %u", ctx, rate,
+			 ctx->stream.probe.rate, ctx->stream.probe.gap, ctx->stream.threshold);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with mutex locked, playback can start once threshold has been reached
+static void _buffering(int n, struct thread_ctx_s *ctx) {
+	if (ctx->stream.state != STREAMING_BUFFERING) return;
+
+	if (ctx->config.stream_cushion && !ctx->stream.probe.done && n > 0) _probe(n, ctx);
+
+	if (ctx->stream.bytes > ctx->stream.threshold) {
+		ctx->stream.state = STREAMING_HTTP;
+		wake_controller(ctx);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// called with mutex locked, in adaptive mode a few cushions at latest measured rate
+static size_t _stream_size(struct thread_ctx_s *ctx) {
+	size_t size;
+
+	if (!ctx->config.stream_cushion || !ctx->stream.probe.rate) return ctx->config.streambuf_size;
+
+	size = (u64_t) ctx->stream.probe.rate * ctx->config.stream_cushion * STREAMBUF_CUSHIONS / 1000;
+	size = max(size, ctx->config.streambuf_min);
+
+	return min(size, ctx->config.streambuf_size);
+}
+
+/*---------------------------------------------------------------------------*/
+// called with mutex locked, dispatch staged ICY stream into streambuf and metadata
+static size_t _icy_demux(struct thread_ctx_s *ctx) {
+	size_t audio = 0;
+
+	while (ctx->stream.stage_pos < ctx->stream.stage_len) {
+		u8_t *p = ctx->stream.stage + ctx->stream.stage_pos;
+		size_t n = ctx->stream.stage_len - ctx->stream.stage_pos;
+
+		if (ctx->stream.meta_next) {
+			// audio, as much as streambuf can take
+			n = _buf_write(ctx->streambuf, p, min(n, ctx->stream.meta_next));
+			if (!n) break;
+			ctx->stream.meta_next -= n;
+			ctx->stream.bytes += n;
+			audio += n;
+		} else {
+			// metadata starts with its length (MAX_HEADER must be more than 16 * 255)
+			if (!ctx->stream.meta_left) {
+				// previous one not sent yet, keep the rest staged
+				if (ctx->stream.meta_send) break;
+				ctx->stream.meta_left = 16 * *p++;
+				ctx->stream.header_len = 0;
+				ctx->stream.stage_pos++;
+				n--;
+			}
+
+			n = min(n, ctx->stream.meta_left);
+			memcpy(ctx->stream.header + ctx->stream.header_len, p, n);
+			ctx->stream.meta_left -= n;
+			ctx->stream.header_len += n;
+
+			if (!ctx->stream.meta_left) {
+				if (ctx->stream.header_len) {
+					*(ctx->stream.header + ctx->stream.header_len) = '\0';
+					LOG_INFO("[%p] icy meta: len: %u\n%s", ctx, ctx->stream.header_len, ctx->stream.header);
+					ctx->stream.meta_send = true;
+					wake_controller(ctx);
+				}
+				ctx->stream.meta_next = ctx->stream.meta_interval;
+			}
+		}
+
+		ctx->stream.stage_pos += n;
+	}
+
+	return audio;
+}
+
+/*---------------------------------------------------------------------------*/
 static void *stream_thread(struct thread_ctx_s *ctx) {
 
 	while (ctx->stream_running) {
@@ -99,6 +240,9 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 		of bytes in the buffer
 		*/
 		space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+#if SPLICE
+		if (ctx->stream.splice >= 0) space = ctx->stream.splice_size - min(_stream_spliced(ctx), ctx->stream.splice_size);
+#endif
 
 		if (ctx->fd < 0 || !space || ctx->stream.state <= STREAMING_WAIT) {
 			UNLOCK_S;
@@ -116,6 +260,7 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 			if (n > 0) {
 				_buf_inc_writep(ctx->streambuf, n);
 				ctx->stream.bytes += n;
+				wake_decode(ctx);
 				LOG_SDEBUG("[%p] ctx->streambuf read %d bytes", ctx, n);
 			}
 			if (n < 0) {
@@ -199,9 +344,43 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 					continue;
 				}
 
-				// receive icy meta data
+				/*
+				ICY stream is read by large blocks and audio is separated from
+				metadata here, so that we don't have to stop at every metadata
+				boundary. A new block is read only once the previous one has
+				been fully dispatched. Spliced streams can't do that
+				*/
+				if (ctx->stream.meta_interval && !SPLICING &&
+					(ctx->stream.stage || (ctx->stream.stage = malloc(ICY_STAGE_SIZE)) != NULL)) {
+					int n;
+
+					if (ctx->stream.stage_pos == ctx->stream.stage_len) {
+						n = recv(ctx->fd, ctx->stream.stage, ICY_STAGE_SIZE, 0);
+						if (n == 0) {
+							LOG_INFO("[%p] end of stream (t:%lld)", ctx, ctx->stream.bytes);
+							_disconnect(DISCONNECT, DISCONNECT_OK, ctx);
+						}
+						if (n < 0 && last_error() != ERROR_WOULDBLOCK) {
+							LOG_WARN("[%p] error reading: %s", ctx, strerror(last_error()));
+							_disconnect(DISCONNECT, REMOTE_DISCONNECT, ctx);
+						}
+						if (n <= 0) {
+							UNLOCK_S;
+							continue;
+						}
+						ctx->stream.stage_len = n;
+						ctx->stream.stage_pos = 0;
+					}
+
+					n = _icy_demux(ctx);
+					if (n) wake_output(ctx);
+
+					_buffering(n, ctx);
+
+					LOG_DEBUG("[%p] streambuf demuxed %d bytes", ctx, n);
 
-				if (ctx->stream.meta_interval && ctx->stream.meta_next == 0) {
+				// receive icy meta data one piece at a time
+				} else if (ctx->stream.meta_interval && ctx->stream.meta_next == 0) {
 					if (ctx->stream.meta_left == 0) {
 						// read meta length
 						u8_t c;
@@ -254,11 +433,26 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 					int n;
 
 					space = min(_buf_space(ctx->streambuf), _buf_cont_write(ctx->streambuf));
+#if SPLICE
+					if (ctx->stream.splice >= 0) space = ctx->stream.splice_size - min(_stream_spliced(ctx), ctx->stream.splice_size);
+#endif
 
 					if (ctx->stream.meta_interval) {
 						space = min(space, ctx->stream.meta_next);
 					}
 
+#if SPLICE
+					// pass-through, socket to output thread's pipe without copy
+					if (ctx->stream.splice >= 0) {
+						n = splice(ctx->fd, NULL, ctx->stream.splice, NULL, space, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+						// socket is readable so pipe is full, let output thread catch up
+						if (n < 0 && errno == EAGAIN) {
+							UNLOCK_S;
+							usleep(10000);
+							continue;
+						}
+					} else
+#endif
 					n = recv(ctx->fd, ctx->streambuf->writep, space, 0);
 					if (n == 0) {
 						LOG_INFO("[%p] end of stream (t:%lld)", ctx, ctx->stream.bytes);
@@ -270,18 +464,19 @@ static void *stream_thread(struct thread_ctx_s *ctx) {
 					}
 
 					if (n > 0) {
+#if SPLICE
+						if (ctx->stream.splice < 0)
+#endif
 						_buf_inc_writep(ctx->streambuf, n);
 						ctx->stream.bytes += n;
 						wake_output(ctx);
+						wake_decode(ctx);
 						if (ctx->stream.meta_interval) {
 							ctx->stream.meta_next -= n;
 						}
 					}
 
-					if (ctx->stream.state == STREAMING_BUFFERING && ctx->stream.bytes > ctx->stream.threshold) {
-						ctx->stream.state = STREAMING_HTTP;
-						wake_controller(ctx);
-					}
+					_buffering(n, ctx);
 
 					LOG_DEBUG("[%p] streambuf read %d bytes", ctx, n);
 				}
@@ -308,7 +503,8 @@ bool stream_thread_init(struct thread_ctx_s *ctx) {
 
 	ctx->streambuf = &ctx->__s_buf;
 
-	buf_init(ctx->streambuf, ctx->config.streambuf_size);
+	// full size is only allocated when first stream starts, mirrored for codecs
+	buf_init_mirror(ctx->streambuf, STREAMBUF_IDLE_SIZE, &ctx->buf_pool);
 	if (ctx->streambuf->buf == NULL) {
 		LOG_ERROR("[%p] unable to malloc buffer", ctx);
 		return false;
@@ -320,9 +516,11 @@ bool stream_thread_init(struct thread_ctx_s *ctx) {
 	*ctx->stream.header = '\0';
 
 	ctx->fd = -1;
-
-#if LINUX || FREEBSD
-	touch_memory(ctx->streambuf->buf, ctx->streambuf->size);
+	ctx->stream.stage = NULL;
+	ctx->stream.stage_len = ctx->stream.stage_pos = 0;
+	ctx->stream.probe.rate = 0;
+#if SPLICE
+	ctx->stream.splice = -1;
 #endif
 
 	pthread_attr_init(&attr);
@@ -340,10 +538,15 @@ void stream_close(struct thread_ctx_s *ctx) {
 	UNLOCK_S;
 	pthread_join(ctx->stream_thread, NULL);
 	free(ctx->stream.header);
+	NFREE(ctx->stream.stage);
 	buf_destroy(ctx->streambuf);
 }
 
 void stream_file(const char *header, size_t header_len, unsigned threshold, struct thread_ctx_s *ctx) {
+	// streambuf might be at idle size
+	LOCK_S;
+	_buf_resize(ctx->streambuf, _stream_size(ctx));
+	UNLOCK_S;
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
@@ -372,9 +575,12 @@ void stream_file(const char *header, size_t header_len, unsigned threshold, stru
 	ctx->stream.meta_next = 0;
 	ctx->stream.meta_left = 0;
 	ctx->stream.meta_send = false;
+	ctx->stream.stage_len = ctx->stream.stage_pos = 0;
 	ctx->stream.sent_headers = false;
 	ctx->stream.bytes = 0;
 	ctx->stream.threshold = threshold;
+	ctx->stream.probe.bytes = 0;
+	ctx->stream.probe.done = false;
 
 	UNLOCK_S;
 }
@@ -408,6 +614,10 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 		return;
 	}
 
+	// streambuf might be at idle size (or sized after previous stream)
+	LOCK_S;
+	_buf_resize(ctx->streambuf, _stream_size(ctx));
+	UNLOCK_S;
 	buf_flush(ctx->streambuf);
 
 	LOCK_S;
@@ -419,6 +629,7 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 	ctx->stream.meta_next = 0;
 	ctx->stream.meta_left = 0;
 	ctx->stream.meta_send = false;
+	ctx->stream.stage_len = ctx->stream.stage_pos = 0;
 	ctx->stream.header_len = header_len;
 	memcpy(ctx->stream.header, header, header_len);
 	*(ctx->stream.header+header_len) = '\0';
@@ -428,6 +639,11 @@ void stream_sock(u32_t ip, u16_t port, const char *header, size_t header_len, un
 	ctx->stream.sent_headers = false;
 	ctx->stream.bytes = 0;
 	ctx->stream.threshold = threshold;
+	ctx->stream.probe.bytes = 0;
+	ctx->stream.probe.done = false;
+
+	// adaptively sized streambuf might be smaller than what LMS expects
+	if (ctx->config.stream_cushion) ctx->stream.threshold = min(threshold, ctx->streambuf->size * 3 / 4);
 
 	UNLOCK_S;
 }
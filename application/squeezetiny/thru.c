@@ -39,35 +39,38 @@ struct thru {
 
 /*---------------------------------------------------------------------------*/
 decode_state thru_decode(struct thread_ctx_s *ctx) {
-	unsigned int in, out;
+	size_t in, out;
+	u8_t *iptr, *optr;
+	bool eos;
 
 	LOCK_S;
-	LOCK_O_direct;
+	eos = ctx->stream.state <= DISCONNECT;
+	UNLOCK_S;
 
-	in = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
+	// output pulls directly from streambuf, only end of stream matters
+	if (ctx->output.shared) return eos ? DECODE_COMPLETE : DECODE_RUNNING;
 
-	if (ctx->stream.state <= DISCONNECT && in == 0) {
-		UNLOCK_O_direct;
-		UNLOCK_S;
-		return DECODE_COMPLETE;
-	}
+	// eos sampled first, so nothing can arrive once it is seen with no data
+	iptr = buf_reserve_read(ctx->streambuf, &in);
+
+	if (eos && in == 0) return DECODE_COMPLETE;
 
 	if (ctx->decode.new_stream) {
 		LOG_INFO("[%p]: setting track_start", ctx);
+		LOCK_O;
 		ctx->output.track_start = ctx->outputbuf->writep;
+		UNLOCK_O;
 		ctx->decode.new_stream = false;
 	}
 
-	out = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf));
+	optr = buf_reserve_write(ctx->outputbuf, &out);
 	out = min(in, out);
 
-	memcpy(ctx->outputbuf->writep, ctx->streambuf->readp, out);
+	// copy outside of locks, only this thread moves these pointers
+	memcpy(optr, iptr, out);
 
-	_buf_inc_readp(ctx->streambuf, out);
-	_buf_inc_writep(ctx->outputbuf, out);
-
-	UNLOCK_O_direct;
-	UNLOCK_S;
+	buf_commit_read(ctx->streambuf, out);
+	buf_commit_write(ctx->outputbuf, out);
 
 	return DECODE_RUNNING;
 }
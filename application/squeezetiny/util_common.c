@@ -434,6 +434,121 @@ int _mutex_timedlock(pthread_mutex_t *m, u32_t ms_wait)
 }
 #endif
 
+/*---------------------------------------------------------------------------*/
+int _cond_timedwait(pthread_cond_t *c, pthread_mutex_t *m, u32_t ms_wait)
+{
+	struct timespec ts;
+#if WIN
+	struct _timeb SysTime;
+
+	_ftime(&SysTime);
+	ts.tv_sec = (long) SysTime.time;
+	ts.tv_nsec = 1000000 * SysTime.millitm;
+#elif LINUX || FREEBSD
+	clock_gettime(CLOCK_REALTIME, &ts);
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = (long) tv.tv_sec;
+	ts.tv_nsec = 1000L * tv.tv_usec;
+#endif
+
+	ts.tv_nsec += (ms_wait % 1000) * 1000000;
+	ts.tv_sec += ms_wait / 1000 + (ts.tv_nsec / 1000000000);
+	ts.tv_nsec = ts.tv_nsec % 1000000000;
+
+	return pthread_cond_timedwait(c, m, &ts);
+}
+
+/*---------------------------------------------------------------------------*/
+int cpu_count(void)
+{
+	int count;
+#if WIN
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	count = info.dwNumberOfProcessors;
+#else
+	count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return count < 1 ? 1 : count;
+}
+
+/*---------------------------------------------------------------------------*/
+void table_init(table_t *table, size_t item_size)
+{
+	memset(table, 0, sizeof(table_t));
+	// round up so that items do not share cache lines
+	table->item_size = (item_size + 63) & ~((size_t) 63);
+	mutex_create(table->mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+void table_free(table_t *table)
+{
+	int i;
+
+	for (i = 0; i < TABLE_CHUNKS && table->chunks[i]; i++) {
+#if WIN
+		_aligned_free(table->chunks[i]);
+#else
+		free(table->chunks[i]);
+#endif
+	}
+
+	mutex_destroy(table->mutex);
+	memset(table, 0, sizeof(table_t));
+}
+
+/*---------------------------------------------------------------------------*/
+void *table_add(table_t *table)
+{
+	u8_t *item = NULL;
+	int chunk;
+
+	mutex_lock(table->mutex);
+
+	chunk = table->count / TABLE_CHUNK;
+
+	// chunks are only allocated when needed and never released
+	if (chunk < TABLE_CHUNKS && !table->chunks[chunk]) {
+		size_t size = table->item_size * TABLE_CHUNK;
+#if WIN
+		table->chunks[chunk] = _aligned_malloc(size, 64);
+#else
+		if (posix_memalign((void**) &table->chunks[chunk], 64, size)) table->chunks[chunk] = NULL;
+#endif
+	}
+
+	if (chunk < TABLE_CHUNKS && table->chunks[chunk]) {
+		item = table->chunks[chunk] + (table->count % TABLE_CHUNK) * table->item_size;
+		memset(item, 0, table->item_size);
+		table->count++;
+	}
+
+	mutex_unlock(table->mutex);
+
+	return item;
+}
+
+/*---------------------------------------------------------------------------*/
+void *table_get(table_t *table, int index)
+{
+	u8_t *item = NULL;
+
+	// count and chunks are only seen once table_add has fully set them
+	mutex_lock(table->mutex);
+	if (index >= 0 && index < table->count) {
+		item = table->chunks[index / TABLE_CHUNK] + (index % TABLE_CHUNK) * table->item_size;
+	}
+	mutex_unlock(table->mutex);
+
+	return item;
+}
+
 /*----------------------------------------------------------------------------*/
 /* 																			  */
 /* NETWORK															  	      */
@@ -25,7 +25,25 @@
 
 #define NFREE(p) if (p) { free(p); p = NULL; }
 
+#define TABLE_CHUNK		8
+#define TABLE_CHUNKS	64
+#define TABLE_MAX		(TABLE_CHUNK * TABLE_CHUNKS)
+
+// growing table of cache aligned items, items never move once added
+typedef struct table_s {
+	mutex_type	mutex;
+	size_t		item_size;
+	int			count;
+	u8_t		*chunks[TABLE_CHUNKS];
+} table_t;
+
 u32_t 		gettime_ms(void);
+int			cpu_count(void);
+
+void		table_init(table_t *table, size_t item_size);
+void		table_free(table_t *table);
+void*		table_add(table_t *table);
+void*		table_get(table_t *table, int index);
 
 char*		url_encode(char *str);
 char*		url_decode(char *str);
@@ -88,12 +88,12 @@ extern int ov_read_tremor(); // needed to enable compilation, not linked
 static size_t _read_cb(void *ptr, size_t size, size_t nmemb, void *datasource) {
 	size_t bytes;
 	struct thread_ctx_s *ctx = datasource;
+	u8_t *iptr = buf_reserve_read(ctx->streambuf, &bytes);
 
-	bytes = min(_buf_used(ctx->streambuf), _buf_cont_read(ctx->streambuf));
 	bytes = min(bytes, size * nmemb);
 
-	memcpy(ptr, ctx->streambuf->readp, bytes);
-	_buf_inc_readp(ctx->streambuf, bytes);
+	memcpy(ptr, iptr, bytes);
+	buf_commit_read(ctx->streambuf, bytes);
 
 	return bytes / size;
 }
@@ -109,23 +109,23 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 	frames_t frames;
 	int bytes, s, n;
 	u8_t *write_buf;
+	size_t space;
 
+	// buffers are not held while decoding, streambuf is read by the callback
 	LOCK_S;
-	LOCK_O_direct;
 	end = (ctx->stream.state <= DISCONNECT);
+	UNLOCK_S;
 
 	IF_DIRECT(
-		frames = min(_buf_space(ctx->outputbuf), _buf_cont_write(ctx->outputbuf)) / BYTES_PER_FRAME;
+		write_buf = buf_reserve_write(ctx->outputbuf, &space);
+		frames = space / BYTES_PER_FRAME;
 	);
 	IF_PROCESS(
+		write_buf = ctx->process.inbuf;
 		frames = ctx->process.max_in_frames;
 	);
 
-	if (!frames && end) {
-		UNLOCK_O_direct;
-		UNLOCK_S;
-		return DECODE_COMPLETE;
-	}
+	if (!frames && end) return DECODE_COMPLETE;
 
 	if (ctx->decode.new_stream) {
 		ov_callbacks cbs;
@@ -142,8 +142,6 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 		if ((err = OV(&gv, open_callbacks, ctx, v->vf, NULL, 0, cbs)) < 0) {
 			LOG_WARN("[%p]: open_callbacks error: %d", ctx, err);
-			UNLOCK_O_direct;
-			UNLOCK_S;
 			return DECODE_COMPLETE;
 		}
 
@@ -152,7 +150,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		info = OV(&gv, info, v->vf, -1);
 
 		LOG_INFO("[%p]: setting track_start", ctx);
-		LOCK_O_not_direct;
+		LOCK_O;
 
 		ctx->output.direct_sample_rate = info->rate;
 		ctx->output.sample_rate = decode_newstream(info->rate, ctx->output.supported_rates, ctx);
@@ -162,7 +160,7 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 		if (ctx->output.fade_mode) _checkfade(true, ctx);
 		ctx->decode.new_stream = false;
 
-		UNLOCK_O_not_direct;
+		UNLOCK_O;
 
 		IF_PROCESS(
 			frames = ctx->process.max_in_frames;
@@ -172,21 +170,12 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 		if (v->channels > 2) {
 			LOG_WARN("[%p]: too many channels: %d", ctx, v->channels);
-			UNLOCK_O_direct;
-			UNLOCK_S;
 			return DECODE_ERROR;
 		}
 	}
 
 	bytes = frames * 2 * v->channels; // samples returned are 16 bits
 
-	IF_DIRECT(
-		write_buf = ctx->outputbuf->writep;
-	);
-	IF_PROCESS(
-		write_buf = ctx->process.inbuf;
-	);
-
 	// write the 16 bits decoded frames into outputbuf even when they are mono
 	if (!TREMOR(&gv)) {
 #if SL_LITTLE_ENDIAN
@@ -202,32 +191,15 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 
 	if (n > 0) {
 
-		frames_t count;
-		s16_t *iptr;
-		s32_t *optr;
-
 		frames = n / 2 / v->channels;
-		count = frames * v->channels;
-
-		// work backward to unpack samples to 4 bytes per sample
-		iptr = (s16_t *)write_buf + count;
-		optr = (s32_t *)write_buf + frames * 2;
-
-		if (v->channels == 2) {
-			while (count--) {
-				*--optr = *--iptr << 16;
-			}
-		} else if (v->channels == 1) {
-			while (count--) {
-				*--optr = *--iptr << 16;
-				*--optr = *iptr   << 16;
-			}
-		}
+
+		// unpack in place samples to 4 bytes per sample
+		conv_s16((s32_t *)write_buf, (s16_t *)write_buf, frames, v->channels);
 
 		ctx->decode.frames += frames;
 
 		IF_DIRECT(
-			_buf_inc_writep(ctx->outputbuf, frames * BYTES_PER_FRAME);
+			buf_commit_write(ctx->outputbuf, frames * BYTES_PER_FRAME);
 		);
 		IF_PROCESS(
 			ctx->process.in_frames = frames;
@@ -238,8 +210,6 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 	} else if (n == 0) {
 
 		LOG_INFO("[%p]: end of stream", ctx);
-		UNLOCK_O_direct;
-		UNLOCK_S;
 		return DECODE_COMPLETE;
 
 	} else if (n == OV_HOLE) {
@@ -250,14 +220,9 @@ static decode_state vorbis_decode( struct thread_ctx_s *ctx) {
 	} else {
 
 		LOG_INFO("[%p]: ov_read error: %d", ctx, n);
-		UNLOCK_O_direct;
-		UNLOCK_S;
 		return DECODE_COMPLETE;
 	}
 
-	UNLOCK_O_direct;
-	UNLOCK_S;
-
 	return DECODE_RUNNING;
 }
 